@@ -5,6 +5,7 @@
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <memory>
@@ -73,7 +74,6 @@ public:
 virtual ~Expr() = default;
 virtual void Print(std::ostream& out) const = 0;
 virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-virtual double Evaluate(const CellLookup& cell_lookup) const = 0;
 
 // higher is tighter
 virtual ExprPrecedence GetPrecedence() const = 0;
@@ -143,25 +143,6 @@ ExprPrecedence GetPrecedence() const override {
   }
 }
 
-double Evaluate(const CellLookup& cell_lookup) const override {
-    switch (type_) {
-           case Add:
-               return lhs_->Evaluate(cell_lookup) + rhs_->Evaluate(cell_lookup);
-           case Subtract:
-               return lhs_->Evaluate(cell_lookup) - rhs_->Evaluate(cell_lookup);
-           case Multiply:
-               return lhs_->Evaluate(cell_lookup) * rhs_->Evaluate(cell_lookup);
-           case Divide: {
-               if (rhs_->Evaluate(cell_lookup) == 0) {
-                   throw FormulaError(FormulaError::Category::Div0);
-               }
-               return lhs_->Evaluate(cell_lookup) / rhs_->Evaluate(cell_lookup);
-           }
-           default:
-               throw std::runtime_error("Unknown operation");
-           }
-}
-
 private:
 Type type_;
 std::unique_ptr<Expr> lhs_;
@@ -196,17 +177,6 @@ ExprPrecedence GetPrecedence() const override {
   return EP_UNARY;
 }
 
-double Evaluate(const CellLookup& cell_lookup) const override {
-    switch (type_) {
-           case UnaryPlus:
-               return operand_->Evaluate(cell_lookup);
-           case UnaryMinus:
-               return -operand_->Evaluate(cell_lookup);
-           default:
-               throw std::runtime_error("Unknown operation");
-           }
-}
-
 private:
 Type type_;
 std::unique_ptr<Expr> operand_;
@@ -214,15 +184,15 @@ std::unique_ptr<Expr> operand_;
 
 class CellExpr final : public Expr {
 public:
-explicit CellExpr(const Position* cell)
+explicit CellExpr(Position cell)
   : cell_(cell) {
 }
 
 void Print(std::ostream& out) const override {
-  if (!cell_->IsValid()) {
+  if (!cell_.IsValid()) {
       out << FormulaError::Category::Ref;
   } else {
-      out << cell_->ToString();
+      out << cell_.ToString();
   }
 }
 
@@ -234,12 +204,8 @@ ExprPrecedence GetPrecedence() const override {
   return EP_ATOM;
 }
 
-double Evaluate(const CellLookup& cell_lookup) const override {
-    return cell_lookup(*cell_);
-}
-
 private:
-const Position* cell_;
+Position cell_;
 };
 
 class NumberExpr final : public Expr {
@@ -260,44 +226,33 @@ ExprPrecedence GetPrecedence() const override {
   return EP_ATOM;
 }
 
-double Evaluate(const CellLookup& cell_lookup) const override {
-  return value_;
-}
-
 private:
 double value_;
 };
 
+// Emits the postfix program directly: exit callbacks arrive in post-order,
+// so no intermediate tree is needed
 class ParseASTListener final : public FormulaBaseListener {
 public:
-std::unique_ptr<Expr> MoveRoot() {
-  assert(args_.size() == 1);
-  auto root = std::move(args_.front());
-  args_.clear();
-
-  return root;
+std::vector<Instruction> MoveCode() {
+  assert(depth_ == 1);
+  return std::move(code_);
 }
 
-std::forward_list<Position> MoveCells() {
-  return std::move(cells_);
+size_t GetStackSize() const {
+  return stack_size_;
 }
 
 public:
 void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override {
-  assert(args_.size() >= 1);
-
-  auto operand = std::move(args_.back());
+  assert(depth_ >= 1);
 
-  UnaryOpExpr::Type type;
   if (ctx->SUB()) {
-      type = UnaryOpExpr::UnaryMinus;
+      code_.emplace_back(OpCode::UnaryMinus);
   } else {
       assert(ctx->ADD() != nullptr);
-      type = UnaryOpExpr::UnaryPlus;
+      code_.emplace_back(OpCode::UnaryPlus);
   }
-
-  auto node = std::make_unique<UnaryOpExpr>(type, std::move(operand));
-  args_.back() = std::move(node);
 }
 
 void exitLiteral(FormulaParser::LiteralContext* ctx) override {
@@ -309,8 +264,8 @@ void exitLiteral(FormulaParser::LiteralContext* ctx) override {
       throw ParsingError("Invalid number: " + valueStr);
   }
 
-  auto node = std::make_unique<NumberExpr>(value);
-  args_.push_back(std::move(node));
+  code_.emplace_back(value);
+  Push();
 }
 
 void exitCell(FormulaParser::CellContext* ctx) override {
@@ -320,33 +275,24 @@ void exitCell(FormulaParser::CellContext* ctx) override {
       throw FormulaException("Invalid position: " + value_str);
   }
 
-  cells_.push_front(value);
-  auto node = std::make_unique<CellExpr>(&cells_.front());
-  args_.push_back(std::move(node));
+  code_.emplace_back(value);
+  Push();
 }
 
 void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override {
-  assert(args_.size() >= 2);
-
-  auto rhs = std::move(args_.back());
-  args_.pop_back();
-
-  auto lhs = std::move(args_.back());
+  assert(depth_ >= 2);
 
-  BinaryOpExpr::Type type;
   if (ctx->ADD()) {
-      type = BinaryOpExpr::Add;
+      code_.emplace_back(OpCode::Add);
   } else if (ctx->SUB()) {
-      type = BinaryOpExpr::Subtract;
+      code_.emplace_back(OpCode::Subtract);
   } else if (ctx->MUL()) {
-      type = BinaryOpExpr::Multiply;
+      code_.emplace_back(OpCode::Multiply);
   } else {
       assert(ctx->DIV() != nullptr);
-      type = BinaryOpExpr::Divide;
+      code_.emplace_back(OpCode::Divide);
   }
-
-  auto node = std::make_unique<BinaryOpExpr>(type, std::move(lhs), std::move(rhs));
-  args_.back() = std::move(node);
+  --depth_;
 }
 
 void visitErrorNode(antlr4::tree::ErrorNode* node) override {
@@ -354,8 +300,14 @@ void visitErrorNode(antlr4::tree::ErrorNode* node) override {
 }
 
 private:
-std::vector<std::unique_ptr<Expr>> args_;
-std::forward_list<Position> cells_;
+void Push() {
+  stack_size_ = std::max(stack_size_, ++depth_);
+}
+
+std::vector<Instruction> code_;
+// values on the stack after the instructions emitted so far
+size_t depth_ = 0;
+size_t stack_size_ = 0;
 };
 
 class BailErrorListener : public antlr4::BaseErrorListener {
@@ -368,6 +320,107 @@ void syntaxError(antlr4::Recognizer* /* recognizer */, antlr4::Token* /* offendi
 }
 };
 
+// Simplifies a postfix program without changing any result bit for bit:
+// folds operations on constants, drops operations that are exact
+// identities in IEEE arithmetic and cancels unary chains. Every cell load
+// is kept in its original order, so errors are reported as before.
+// x+0 is kept: for x = -0 it yields +0, which prints differently.
+std::vector<Instruction> Simplify(const std::vector<Instruction>& code) {
+  // a subexpression occupies result[start, result.size()) when it is on
+  // top of the stack; constants are single PushNumber instructions
+  struct Operand {
+      size_t start;
+      bool constant;
+  };
+
+  std::vector<Instruction> result;
+  result.reserve(code.size());
+  std::vector<Operand> operands;
+  auto is_constant = [&result](const Operand& operand, double value) {
+      return operand.constant && result[operand.start].number == value
+             && std::signbit(result[operand.start].number) == std::signbit(value);
+  };
+  auto ends_with_negation = [&result](const Operand& operand) {
+      return !operand.constant && result.back().code == OpCode::UnaryMinus;
+  };
+
+  for (const Instruction& instruction : code) {
+      switch (instruction.code) {
+          case OpCode::PushNumber:
+              operands.push_back({result.size(), true});
+              result.push_back(instruction);
+              break;
+          case OpCode::LoadCell:
+              operands.push_back({result.size(), false});
+              result.push_back(instruction);
+              break;
+          case OpCode::UnaryPlus:
+              break;
+          case OpCode::UnaryMinus:
+              if (operands.back().constant) {
+                  result.back().number = -result.back().number;
+              } else if (ends_with_negation(operands.back())) {
+                  result.pop_back();
+              } else {
+                  result.push_back(instruction);
+              }
+              break;
+          default: {
+              const Operand rhs = operands.back();
+              operands.pop_back();
+              Operand& lhs = operands.back();
+              OpCode op = instruction.code;
+
+              if (lhs.constant && rhs.constant
+                  && !(op == OpCode::Divide && result[rhs.start].number == 0)) {
+                  const double x = result[lhs.start].number;
+                  const double y = result[rhs.start].number;
+                  double value = 0;
+                  switch (op) {
+                      case OpCode::Add:
+                          value = x + y;
+                          break;
+                      case OpCode::Subtract:
+                          value = x - y;
+                          break;
+                      case OpCode::Multiply:
+                          value = x * y;
+                          break;
+                      default:
+                          value = x / y;
+                          break;
+                  }
+                  result.pop_back();
+                  result.back().number = value;
+                  break;
+              }
+
+              // x*1, x/1 and x-0 are x
+              if (((op == OpCode::Multiply || op == OpCode::Divide) && is_constant(rhs, 1))
+                  || (op == OpCode::Subtract && is_constant(rhs, 0.0))) {
+                  result.pop_back();
+                  break;
+              }
+              // 1*x is x
+              if (op == OpCode::Multiply && is_constant(lhs, 1)) {
+                  result.erase(result.begin() + lhs.start);
+                  lhs.constant = false;
+                  break;
+              }
+              // x-(-y) is x+y and x+(-y) is x-y
+              if ((op == OpCode::Add || op == OpCode::Subtract) && ends_with_negation(rhs)) {
+                  result.pop_back();
+                  op = op == OpCode::Add ? OpCode::Subtract : OpCode::Add;
+              }
+              result.emplace_back(op);
+              lhs.constant = false;
+              break;
+          }
+      }
+  }
+  return result;
+}
+
 }  // namespace
 }  // namespace ASTImpl
 
@@ -392,7 +445,7 @@ tree::ParseTree* tree = parser.main();
 ASTImpl::ParseASTListener listener;
 tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
 
-return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+return FormulaAST(listener.MoveCode(), listener.GetStackSize());
 }
 
 FormulaAST ParseFormulaAST(const std::string& in_str) {
@@ -400,6 +453,52 @@ std::istringstream in(in_str);
 return ParseFormulaAST(in);
 }
 
+std::unique_ptr<ASTImpl::Expr> FormulaAST::BuildTree(Position origin) const {
+using namespace ASTImpl;
+
+std::vector<std::unique_ptr<Expr>> args;
+args.reserve(stack_size_);
+auto binary = [&args](BinaryOpExpr::Type type) {
+  auto rhs = std::move(args.back());
+  args.pop_back();
+  args.back() = std::make_unique<BinaryOpExpr>(type, std::move(args.back()), std::move(rhs));
+};
+auto unary = [&args](UnaryOpExpr::Type type) {
+  args.back() = std::make_unique<UnaryOpExpr>(type, std::move(args.back()));
+};
+for (const Instruction& instruction : code_) {
+  switch (instruction.code) {
+      case OpCode::PushNumber:
+          args.push_back(std::make_unique<NumberExpr>(instruction.number));
+          break;
+      case OpCode::LoadCell:
+          args.push_back(std::make_unique<CellExpr>(
+                  Position{origin.row + instruction.cell.row, origin.col + instruction.cell.col}));
+          break;
+      case OpCode::Add:
+          binary(BinaryOpExpr::Add);
+          break;
+      case OpCode::Subtract:
+          binary(BinaryOpExpr::Subtract);
+          break;
+      case OpCode::Multiply:
+          binary(BinaryOpExpr::Multiply);
+          break;
+      case OpCode::Divide:
+          binary(BinaryOpExpr::Divide);
+          break;
+      case OpCode::UnaryPlus:
+          unary(UnaryOpExpr::UnaryPlus);
+          break;
+      case OpCode::UnaryMinus:
+          unary(UnaryOpExpr::UnaryMinus);
+          break;
+  }
+}
+assert(args.size() == 1);
+return std::move(args.front());
+}
+
 void FormulaAST::PrintCells(std::ostream& out) const {
 for (auto cell : cells_) {
   out << cell.ToString() << ' ';
@@ -407,21 +506,60 @@ for (auto cell : cells_) {
 }
 
 void FormulaAST::Print(std::ostream& out) const {
-root_expr_->Print(out);
+BuildTree(Position{0, 0})->Print(out);
 }
 
 void FormulaAST::PrintFormula(std::ostream& out) const {
-root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
+PrintFormula(out, Position{0, 0});
 }
 
-double FormulaAST::Execute(const CellLookup& cell_lookup) const {
-return root_expr_->Evaluate(cell_lookup);
+void FormulaAST::PrintFormula(std::ostream& out, Position origin) const {
+BuildTree(origin)->PrintFormula(out, ASTImpl::EP_ATOM);
 }
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
-: root_expr_(std::move(root_expr))
-, cells_(std::move(cells)) {
-cells_.sort();  // to avoid sorting in GetReferencedCells
+void FormulaAST::MoveCells(int row_offset, int col_offset) {
+for (auto* program : {&code_, &simplified_}) {
+  for (ASTImpl::Instruction& instruction : *program) {
+      if (instruction.code == ASTImpl::OpCode::LoadCell) {
+          instruction.cell.row += row_offset;
+          instruction.cell.col += col_offset;
+      }
+  }
+}
+// a shift keeps the cells sorted
+for (Position& cell : cells_) {
+  cell.row += row_offset;
+  cell.col += col_offset;
+}
+}
+
+ExecutionResult FormulaAST::Execute(const CellLookup& cell_lookup) const {
+return Run(cell_lookup);
+}
+
+size_t FormulaAST::GetMemoryUsage() const {
+return (code_.capacity() + simplified_.capacity()) * sizeof(ASTImpl::Instruction)
+       + cells_.capacity() * sizeof(Position);
+}
+
+FormulaAST::FormulaAST(std::vector<ASTImpl::Instruction> code, size_t stack_size)
+: code_(std::move(code))
+, stack_size_(stack_size) {
+code_.shrink_to_fit();
+simplified_ = ASTImpl::Simplify(code_);
+if (simplified_.size() == code_.size()) {
+  simplified_.clear();
+}
+simplified_.shrink_to_fit();
+for (const ASTImpl::Instruction& instruction : code_) {
+  if (instruction.code == ASTImpl::OpCode::LoadCell) {
+      cells_.push_back(instruction.cell);
+  }
+}
+// to avoid sorting in GetReferencedCells
+std::sort(cells_.begin(), cells_.end());
+cells_.erase(std::unique(cells_.begin(), cells_.end()), cells_.end());
+cells_.shrink_to_fit();
 }
 
 FormulaAST::~FormulaAST() = default;
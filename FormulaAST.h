@@ -1,51 +1,181 @@
 #pragma once
 
+#include "errors.h"
 #include "FormulaLexer.h"
 #include "position.h"
 
-#include <forward_list>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <stdexcept>
+#include <variant>
+#include <vector>
 
-using CellLookup = std::function<double(Position)>;
+// A number or the error that stopped the evaluation
+using ExecutionResult = std::variant<double, FormulaError>;
+using CellLookup = std::function<ExecutionResult(Position)>;
 
 namespace ASTImpl {
 class Expr;
-}
+
+enum class OpCode : uint8_t {
+    PushNumber,
+    LoadCell,
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    UnaryPlus,
+    UnaryMinus,
+};
+
+// One step of the postfix program a formula is compiled into: operands are
+// pushed onto the evaluation stack, operators replace their arguments on
+// the stack with the result
+struct Instruction {
+    explicit Instruction(OpCode op)
+        : code(op)
+        , number(0) {
+    }
+    explicit Instruction(double value)
+        : code(OpCode::PushNumber)
+        , number(value) {
+    }
+    explicit Instruction(Position pos)
+        : code(OpCode::LoadCell)
+        , cell(pos) {
+    }
+
+    OpCode code;
+    union {
+        double number;  // PushNumber
+        Position cell;  // LoadCell
+    };
+};
+}  // namespace ASTImpl
 
 class ParsingError : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+// A parsed formula kept as a flat postfix program. The expression tree is
+// not stored: it is rebuilt from the program only to print the formula.
 class FormulaAST {
 public:
-    explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr,
-                        std::forward_list<Position> cells);
+    FormulaAST(std::vector<ASTImpl::Instruction> code, size_t stack_size);
     FormulaAST(FormulaAST&&) = default;
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
 
-    double Execute(const CellLookup& cell_lookup) const;
+    // Errors are returned as values: the first error met, from a cell
+    // lookup or a division by zero, ends the evaluation
+    ExecutionResult Execute(const CellLookup& cell_lookup) const;
+    // The same with a lookup of any callable type, called directly so that
+    // it can be inlined into the interpreter loop
+    template <typename Lookup>
+    ExecutionResult Run(const Lookup& cell_lookup) const;
+    // Approximate heap memory used by the program and the cell list, in bytes
+    size_t GetMemoryUsage() const;
     void PrintCells(std::ostream& out) const;
     void Print(std::ostream& out) const;
     void PrintFormula(std::ostream& out) const;
+    // Prints the formula with every cell shifted by origin, for formulas
+    // whose cells are stored relative to their own position
+    void PrintFormula(std::ostream& out, Position origin) const;
 
-    std::forward_list<Position>& GetCells() {
-        return cells_;
+    // Shifts every referenced cell; the cells may become invalid positions,
+    // so the result is only meaningful when printed or run with a matching
+    // origin
+    void MoveCells(int row_offset, int col_offset);
+
+    // Number of instructions executed per evaluation
+    size_t GetInstructionCount() const {
+        return GetProgram().size();
     }
 
-    const std::forward_list<Position>& GetCells() const {
+    // Referenced cells, sorted and without duplicates
+    const std::vector<Position>& GetCells() const {
         return cells_;
     }
 
 private:
-    std::unique_ptr<ASTImpl::Expr> root_expr_;
+    std::unique_ptr<ASTImpl::Expr> BuildTree(Position origin) const;
+
+    const std::vector<ASTImpl::Instruction>& GetProgram() const {
+        return simplified_.empty() ? code_ : simplified_;
+    }
+
+    // the program as written, used for printing
+    std::vector<ASTImpl::Instruction> code_;
+    // the same program with constants folded and redundant operations
+    // removed, used for execution; empty if nothing could be simplified
+    std::vector<ASTImpl::Instruction> simplified_;
+    // the largest number of values on the stack during execution
+    size_t stack_size_;
 
     // physically stores cells so that they can be
     // efficiently traversed without going through
-    // the whole AST
-    std::forward_list<Position> cells_;
+    // the whole program
+    std::vector<Position> cells_;
 };
 
+template <typename Lookup>
+ExecutionResult FormulaAST::Run(const Lookup& cell_lookup) const {
+    using ASTImpl::OpCode;
+
+    // typical formulas fit into the fixed buffer, deeper ones get a heap stack
+    static const size_t INLINE_STACK_SIZE = 32;
+    double inline_stack[INLINE_STACK_SIZE];
+    std::unique_ptr<double[]> heap_stack;
+    double* stack = inline_stack;
+    if (stack_size_ > INLINE_STACK_SIZE) {
+        heap_stack = std::make_unique<double[]>(stack_size_);
+        stack = heap_stack.get();
+    }
+
+    // top points past the last value on the stack
+    double* top = stack;
+    for (const ASTImpl::Instruction& instruction : GetProgram()) {
+        switch (instruction.code) {
+        case OpCode::PushNumber:
+            *top++ = instruction.number;
+            break;
+        case OpCode::LoadCell: {
+            const ExecutionResult value = cell_lookup(instruction.cell);
+            if (const auto* error = std::get_if<FormulaError>(&value)) {
+                return *error;
+            }
+            *top++ = *std::get_if<double>(&value);
+            break;
+        }
+        case OpCode::Add:
+            --top;
+            top[-1] += *top;
+            break;
+        case OpCode::Subtract:
+            --top;
+            top[-1] -= *top;
+            break;
+        case OpCode::Multiply:
+            --top;
+            top[-1] *= *top;
+            break;
+        case OpCode::Divide:
+            --top;
+            if (*top == 0) {
+                return FormulaError(FormulaError::Category::Div0);
+            }
+            top[-1] /= *top;
+            break;
+        case OpCode::UnaryPlus:
+            break;
+        case OpCode::UnaryMinus:
+            top[-1] = -top[-1];
+            break;
+        }
+    }
+    return top[-1];
+}
+
 FormulaAST ParseFormulaAST(std::istream& in);
 FormulaAST ParseFormulaAST(const std::string& in_str);
@@ -1,161 +1,277 @@
 #include "cell.h"
 #include "sheet.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <new>
 #include <string>
-#include <optional>
-#include <stack>
+#include <type_traits>
 
 using namespace std::literals;
 
+namespace {
+
+// Значение текста ячейки в формуле: пустой текст - ноль, текст числа -
+// число, иначе ошибка #VALUE!
+FormulaInterface::Value ParseNumber(std::string_view text) {
+    if (text.empty()) {
+        return 0.0;
+    }
+    if (text[0] == '\'') {
+        return FormulaError(FormulaError::Category::Value);
+    }
+    // Те же правила, что у std::stod: начальные пробелы пропускаются,
+    // разбирается самый длинный числовой префикс
+    const std::string buffer(text);
+    char* end = nullptr;
+    errno = 0;
+    const double result = std::strtod(buffer.c_str(), &end);
+    if (end == buffer.c_str() || errno == ERANGE) {
+        return FormulaError(FormulaError::Category::Value);
+    }
+    return result;
+}
+
+}  // namespace
+
 Cell::Cell(Sheet& sheet, Position cellPosition)
-    : sheet_(sheet), ownPosition_(cellPosition), impl_(std::make_unique<EmptyImpl>()){
+    : sheet_(sheet)
+    , ownRow_(static_cast<uint16_t>(cellPosition.row))
+    , ownCol_(static_cast<uint16_t>(cellPosition.col))
+    , formula_(nullptr) {
 }
 
-Cell::~Cell() {}
+Cell::~Cell() {
+    DestroyContent();
+}
 
 void Cell::Set(std::string text) {
-    if (text != impl_->GetText()) {
-        if (text.size() > 1 && text[0] == '=') {
+    if (text != GetText()) {
+        RecalcStats* stats = sheet_.GetActiveRecalcStats();
+        if (IsFormulaText(text)) {
 
             // Проверка на корректность синтаксиса формулы
-            std::unique_ptr<FormulaImpl> newFormula;
+            std::unique_ptr<FormulaInterface> newFormula;
             try {
-                newFormula = std::make_unique<FormulaImpl>(sheet_, text);
+                ScopedLatency timer(stats ? &stats->parse : nullptr);
+                newFormula = ParseFormula(std::string_view(text).substr(1), GetPosition(), sheet_.GetFormulaPool());
             }  catch (...) {
                 throw FormulaException("Formula syntax error"s);
             }
 
-            // Проверка на циклические зависимости
-            auto newDependencesDown_ = newFormula->GetReferencedCells();
-            if (!IsIndependent(newDependencesDown_)) {
-                throw CircularDependencyException("Circular dependency found"s);
+            // Проверка на циклические зависимости с обновлением
+            // топологического порядка
+            {
+                ScopedLatency timer(stats ? &stats->cycleCheck : nullptr);
+                if (!sheet_.UpdateOrder(GetPosition(), newFormula->GetReferencedCells())) {
+                    throw CircularDependencyException("Circular dependency found"s);
+                }
             }
 
+            ScopedLatency timer(stats ? &stats->invalidation : nullptr);
+            sheet_.NewRevision();
+
             // Отмена регистрации в зависимостях вниз
             Unregister();
 
-            // Очистка кэша в ячейке и в зависимостях вверх
-            ResetCache();
-
             // Обновление содержимого ячейки
-            delete impl_.release();
-            impl_ = std::move(newFormula);
-
-            // Формирование списка зависимостей вниз
-            dependencesDown_ = newDependencesDown_;
+            SetContent(std::move(newFormula));
+            MarkChanged();
 
             // Регистрация в зависимостях вниз
             Register();
 
 
         } else {
-            // Очистка кэша в ячейке и в зависимостях вверх
-            ResetCache();
+            ScopedLatency timer(stats ? &stats->invalidation : nullptr);
+            sheet_.NewRevision();
 
             // Отмена регистрации в зависимостях вниз
             Unregister();
 
-            // Очистка списка зависимосей вниз
-            dependencesDown_.clear();
-
             // Обновление содержимого ячейки
-            delete impl_.release();
-            impl_ = std::make_unique<TextImpl>(text);
+            SetContent(text);
+            MarkChanged();
         }
     }
 }
 
+bool Cell::IsFormulaText(const std::string& text) {
+    return text.size() > 1 && text[0] == '=';
+}
+
+void Cell::SetUnchecked(std::string text, std::unique_ptr<FormulaInterface> formula) {
+    Unregister();
+    if (formula) {
+        SetContent(std::move(formula));
+    } else {
+        SetContent(text);
+    }
+    MarkChanged();
+}
+
 void Cell::Clear() {
-    delete impl_.release();
-    impl_ = std::make_unique<EmptyImpl>();
+    Set(std::string());
 }
 
 Cell::Value Cell::GetValue() const {
-    if (!cachedValue_) {
-        cachedValue_ = impl_->GetValue();
-    }
-    return *cachedValue_;
+    return std::visit([](const auto& value) -> Value {
+        if constexpr (std::is_same_v<std::decay_t<decltype(value)>, std::string_view>) {
+            return std::string(value);
+        } else {
+            return value;
+        }
+    }, GetValueView());
 }
 
-std::string Cell::GetText() const {
-    return impl_->GetText();
+Cell::ValueView Cell::GetValueView() const {
+    if (kind_ != Kind::Formula) {
+        return VisibleText(GetTextView());
+    }
+    PrepareCache();
+    if (cacheState_ == CacheState::Number) {
+        return cachedValue_.number;
+    } else {
+        return FormulaError(cachedValue_.error);
+    }
 }
 
-std::vector<Position> Cell::GetReferencedCells() const {
-    return dependencesDown_;
+void Cell::MarkVerified() const {
+    verifiedAt_ = sheet_.GetRevision();
+    if (RecalcStats* stats = sheet_.GetActiveRecalcStats(); stats) {
+        stats->verifications.Add();
+    }
 }
 
-bool Cell::IsReferenced() const {
-    return dependencesUp_.size() != 0;
+void Cell::Evaluate() const {
+    RecalcStats* stats = sheet_.GetActiveRecalcStats();
+    if (stats) {
+        stats->evaluations.Add();
+    }
+    ScopedLatency timer(stats ? &stats->evaluation : nullptr);
+    const CacheState previousState = cacheState_;
+    const auto previousValue = cachedValue_;
+    FormulaInterface::Value result = formula_->Evaluate(sheet_);
+    if (std::holds_alternative<double>(result)) {
+        cachedValue_.number = std::get<double>(result);
+        cacheState_ = CacheState::Number;
+    } else {
+        cachedValue_.error = std::get<FormulaError>(result).GetCategory();
+        cacheState_ = CacheState::Error;
+    }
+
+    // Раннее отсечение: если значение не изменилось, ревизия изменения
+    // остаётся прежней, и зависимые формулы не пересчитываются. Числа
+    // сравниваются побитово, чтобы 0 и -0, которые выводятся по-разному,
+    // считались разными значениями.
+    bool unchanged = previousState == cacheState_;
+    if (unchanged && cacheState_ == CacheState::Number) {
+        unchanged = std::memcmp(&previousValue.number, &cachedValue_.number, sizeof(double)) == 0;
+    } else if (unchanged) {
+        unchanged = previousValue.error == cachedValue_.error;
+    }
+    verifiedAt_ = sheet_.GetRevision();
+    if (!unchanged) {
+        changedAt_ = verifiedAt_;
+    }
 }
 
-void Cell::RegisterAsDependent(const Position &pos) const {
-    if (!pos.IsValid()) {
-        throw InvalidPositionException("Invalid cell position"s);
+std::string Cell::GetText() const {
+    switch (kind_) {
+    case Kind::Text:
+        return std::string(text_.View());
+    case Kind::Formula:
+        return '=' + formula_->GetExpression();
+    default:
+        return "";
     }
-    dependencesUp_.insert(pos);
 }
 
-void Cell::UnregisterAsDependent(const Position &pos) const {
-    if (!pos.IsValid()) {
-        throw InvalidPositionException("Invalid cell position"s);
+std::string_view Cell::VisibleText(std::string_view text) {
+    if (!text.empty() && text[0] == '\'') {
+        text.remove_prefix(1);
     }
-    if (auto it = dependencesUp_.find(pos); it != dependencesUp_.end()) {
-        dependencesUp_.erase(it);
+    return text;
+}
+
+std::vector<Position> Cell::GetReferencedCells() const {
+    if (kind_ == Kind::Formula) {
+        return formula_->GetReferencedCells();
     }
+    return {};
 }
 
-void Cell::ResetCache() const {
-    cachedValue_.reset();
-    for (const Position pos: dependencesUp_) {
-        if (const Cell* cell = dynamic_cast<Cell*>(sheet_.GetCell(pos)); cell) {
-            cell->ResetCache();
-        }
+void Cell::AddMemoryUsage(MemoryStats& stats) const {
+    if (kind_ == Kind::Formula) {
+        stats.formulas += formula_->GetMemoryUsage();
     }
+    stats.caches += sizeof(cachedValue_) + sizeof(cacheState_) + sizeof(changedAt_) + sizeof(verifiedAt_);
 }
 
-void Cell::Unregister() const {
-    for (const Position pos: dependencesDown_) {
-        if (const Cell* cell = dynamic_cast<Cell*>(sheet_.GetCell(pos)); cell) {
-            cell->UnregisterAsDependent(ownPosition_);
-        }
+void Cell::SetContent(std::string_view text) {
+    DestroyContent();
+    if (!text.empty()) {
+        new (&text_) PooledString(sheet_.GetStringPool(), text);
+        kind_ = Kind::Text;
     }
 }
 
-void Cell::Register() const {
-    for (const Position pos: dependencesDown_) {
-        if (const Cell* cell = dynamic_cast<Cell*>(sheet_.GetCell(pos)); cell) {
-            cell->RegisterAsDependent(ownPosition_);
+void Cell::SetContent(std::unique_ptr<FormulaInterface> formula) {
+    DestroyContent();
+    formula_ = formula.release();
+    kind_ = Kind::Formula;
+}
+
+void Cell::MarkChanged() {
+    if (RecalcStats* stats = sheet_.GetActiveRecalcStats(); stats) {
+        stats->changedCells.Add();
+    }
+    cacheState_ = CacheState::Empty;
+    if (kind_ == Kind::Text) {
+        // Числовое значение текста вычисляется один раз, а не при каждой
+        // ссылке на ячейку
+        const FormulaInterface::Value number = ParseNumber(text_.View());
+        if (std::holds_alternative<double>(number)) {
+            cachedValue_.number = std::get<double>(number);
+            cacheState_ = CacheState::Number;
         } else {
-            sheet_.SetCell(pos, "");
-            dynamic_cast<Cell*>(sheet_.GetCell(pos))->RegisterAsDependent(pos);
+            cachedValue_.error = std::get<FormulaError>(number).GetCategory();
+            cacheState_ = CacheState::Error;
         }
     }
+    changedAt_ = sheet_.GetRevision();
+    if (!queued_) {
+        queued_ = true;
+        sheet_.AddChangedCell(GetPosition());
+    }
 }
 
-bool Cell::IsIndependent(const std::vector<Position>& cellPositions) {
-    std::stack<Position> toVisit;
-    std::unordered_set<Position, PositionHasher> visited;
-    for (auto pos: cellPositions) {
-        toVisit.push(pos);
+void Cell::DestroyContent() {
+    if (kind_ == Kind::Text) {
+        text_.~PooledString();
+    } else if (kind_ == Kind::Formula) {
+        delete formula_;
     }
+    formula_ = nullptr;
+    kind_ = Kind::Empty;
+}
 
-    while (!toVisit.empty()) {
-        Position currentPos = toVisit.top();
-        if (currentPos == ownPosition_) {
-            return false;
-        }
-        toVisit.pop();
-        visited.insert(currentPos);
-        if (auto* cellPtr = sheet_.GetCell(currentPos); cellPtr) {
-            for (auto& pos: cellPtr->GetReferencedCells()) {
-                if (visited.count(pos)==0) {
-                    toVisit.push(pos);
-                }
-            }
-        }
+void Cell::ResetCache() const {
+    cacheState_ = CacheState::Empty;
+}
+
+void Cell::Unregister() const {
+    for (const Position pos: GetReferencedCells()) {
+        sheet_.RemoveDependent(pos, GetPosition());
+    }
+}
+
+void Cell::Register() const {
+    for (const Position pos: GetReferencedCells()) {
+        sheet_.AddDependent(pos, GetPosition());
     }
-    return true;
 }
@@ -1,12 +1,14 @@
 #pragma once
 
+#include "dependency_graph.h"
 #include "formula.h"
 #include "position.h"
+#include "sheet.h"
+#include "string_pool.h"
 
-#include <optional>
-#include <unordered_set>
-
-class Sheet;
+#include <cstdint>
+#include <memory>
+#include <string_view>
 
 class CellInterface {
 public:
@@ -33,127 +35,207 @@ public:
 
 
 
-class Cell : public CellInterface {
+// Ячейка хранит содержимое в компактном размеченном представлении: пустая
+// ячейка, текст (строка из пула таблицы) или формула. Значение формулы
+// кэшируется прямо в ячейке, зависимости хранятся в общем графе таблицы.
+// Актуальность кэша определяется по ревизиям таблицы: изменение ячейки не
+// обходит зависимые от неё ячейки, а проверяется при чтении.
+class Cell final : public CellInterface {
 public:
     Cell(Sheet& sheet, Position cellPosition);
+    Cell(const Cell&) = delete;
+    Cell& operator=(const Cell&) = delete;
     ~Cell();
 
     void Set(std::string text);
     void Clear();
 
+    // Является ли текст формулой (а не обычным текстом)
+    static bool IsFormulaText(const std::string& text);
+
+    // Устанавливает содержимое без проверки циклических зависимостей, без
+    // регистрации в зависимостях вниз и без сброса кэша зависимых ячеек.
+    // formula - разобранная формула, если text является формулой.
+    // Используется пакетной загрузкой, которая выполняет эти шаги сама,
+    // один раз для всех ячеек пакета.
+    void SetUnchecked(std::string text, std::unique_ptr<FormulaInterface> formula);
+
     Value GetValue() const override;
     std::string GetText() const override;
     std::vector<Position> GetReferencedCells() const override;
 
-    bool IsReferenced() const;
+    // Значение ячейки, в котором текст не копируется, а ссылается на
+    // содержимое ячейки и действителен до её изменения
+    using ValueView = std::variant<std::string_view, double, FormulaError>;
+    ValueView GetValueView() const;
 
-    // можно передавать аргументом указатель на ячейку, и это будет работать быстрее,
-    // но для масштабируемости лучше передавать позицию
-    void RegisterAsDependent(const Position& pos) const;
-
-    void UnregisterAsDependent(const Position& pos) const;
-
-    void ResetCache() const;
+    bool IsFormula() const {
+        return kind_ == Kind::Formula;
+    }
 
-private:
+    // Значение ячейки как аргумента формулы: число, ошибка формулы или
+    // #VALUE! для текста, который не является числом
+    FormulaInterface::Value GetArgumentValue() const {
+        if (kind_ == Kind::Empty) {
+            return 0.0;
+        }
+        if (kind_ == Kind::Formula) {
+            PrepareCache();
+        }
+        // Для текста в кэше хранится его числовое значение
+        if (cacheState_ == CacheState::Number) {
+            return cachedValue_.number;
+        }
+        return FormulaError(cachedValue_.error);
+    }
+    // Текст нетекстовой ячейки без копирования; для формулы пуст
+    std::string_view GetTextView() const {
+        return kind_ == Kind::Text ? text_.View() : std::string_view();
+    }
 
-    class Impl {
-    public:
-        virtual ~Impl() {}
+    // Видимая часть текста: без экранирующего апострофа
+    static std::string_view VisibleText(std::string_view text);
 
-        virtual void Set(std::string text) = 0;
-        virtual void Clear() = 0;
+    // Добавляет к stats формулу и место под кэш ячейки
+    void AddMemoryUsage(MemoryStats& stats) const;
 
-        virtual Value GetValue() const = 0;
-        virtual std::string GetText() const = 0;
-    };
+    // Сбрасывает кэш формулы, не затрагивая зависимые ячейки. Используется,
+    // когда удаляется ячейка, на которую ссылается формула.
+    void ResetCache() const;
 
-    class EmptyImpl : public Impl {
-    public:
-        virtual void Set(std::string text) override {
-        }
-        virtual void Clear() override {
-        }
+    Position GetPosition() const {
+        return {ownRow_, ownCol_};
+    }
+
+    // Номер ячейки в топологическом порядке таблицы: ячейка, на которую
+    // ссылается формула, имеет меньший номер, чем ячейка с формулой
+    int GetOrder() const {
+        return order_;
+    }
+    void SetOrder(int order) {
+        order_ = order;
+    }
+
+    // Ревизия таблицы, в которой значение ячейки последний раз изменилось
+    uint32_t GetChangedAt() const {
+        return changedAt_;
+    }
+    // Ревизия, в которой кэш формулы последний раз проверен
+    uint32_t GetVerifiedAt() const {
+        return verifiedAt_;
+    }
+    bool HasCache() const {
+        return cacheState_ != CacheState::Empty;
+    }
+    // Актуально ли значение ячейки в текущей ревизии таблицы без проверки
+    // ячеек, от которых она зависит
+    bool IsUpToDate() const {
+        return kind_ != Kind::Formula
+                || (cacheState_ != CacheState::Empty && sheet_.IsVerified(verifiedAt_));
+    }
+    // Отмечает кэш формулы проверенным в текущей ревизии
+    void MarkVerified() const;
+
+    // Вычисляет формулу и сохраняет значение в кэше. Значения ячеек, от
+    // которых она зависит, должны быть уже актуальны. Ревизия изменения
+    // обновляется, только если значение отличается от прежнего.
+    void Evaluate() const;
+
+    // Ячейка уже находится в списке изменённых ячеек таблицы
+    bool IsQueued() const {
+        return queued_;
+    }
+    void SetQueued(bool queued) {
+        queued_ = queued;
+    }
+
+    // Обнуляет ревизии при переполнении счётчика ревизий таблицы; кэш
+    // должен быть актуален
+    void ResetRevisions() {
+        changedAt_ = 0;
+        verifiedAt_ = 0;
+    }
+
+    // Вершина ячейки в графе зависимостей таблицы; NO_NODE, пока ячейка
+    // не участвует в зависимостях
+    DependencyGraph::NodeId GetNodeId() const {
+        return nodeId_;
+    }
+    void SetNodeId(DependencyGraph::NodeId nodeId) {
+        nodeId_ = nodeId;
+    }
 
-        virtual Value GetValue() const override {
-            return "";
-        }
+    void Register() const;
 
-        virtual std::string GetText() const override {
-            return "";
-        }
+private:
+    enum class Kind : uint8_t {
+        Empty,
+        Text,
+        Formula,
     };
 
-    class TextImpl : public Impl {
-    public:
-        TextImpl(const std::string& text)
-            : text_(text) {
-        }
-        virtual void Set(std::string text) override {
-            text_ = text;
-        }
-        virtual void Clear() override {
-            text_.clear();
-        }
-
-        virtual Value GetValue() const override {
-            if (text_[0] == '\'') {
-                return text_.substr(1);
-            } else {
-                return text_;
-            }
-        }
+    enum class CacheState : uint8_t {
+        Empty,
+        Number,
+        Error,
+    };
 
-        virtual std::string GetText() const override {
-            return text_;
-        }
+    // Отмечает изменение содержимого в текущей ревизии таблицы: кэш
+    // формулы сбрасывается, для текста вычисляется числовое значение, а
+    // зависимые ячейки узнают об изменении, сравнивая ревизии при чтении
+    void MarkChanged();
 
-    private:
-        std::string text_;
-    };
+    // Заменяет содержимое ячейки; кэш и зависимости не затрагиваются
+    void SetContent(std::string_view text);
+    void SetContent(std::unique_ptr<FormulaInterface> formula);
+    void DestroyContent();
 
-    class FormulaImpl : public Impl {
-    public:
-        FormulaImpl(SheetInterface& sheet, const std::string& text)
-            : sheet_(dynamic_cast<SheetInterface&>(sheet)), formula_(ParseFormula(text.substr(1))) {
-        }
-        virtual void Set(std::string text) override {
-            formula_ = ParseFormula(text);
-        }
-        virtual void Clear() override {
-            delete formula_.release();
-        }
+    void Unregister() const;
 
-        virtual Value GetValue() const override {
-            auto result = formula_->Evaluate(sheet_);
-            if (std::holds_alternative<double>(result)) {
-                return std::get<double>(result);
-            } else {
-                return std::get<FormulaError>(result);
+    // Делает кэш формулы актуальным перед чтением и учитывает чтение в
+    // статистике
+    void PrepareCache() const {
+        RecalcStats* stats = sheet_.GetActiveRecalcStats();
+        if (!IsUpToDate()) {
+            if (stats) {
+                stats->cacheMisses.Add();
             }
+            sheet_.BringUpToDate(*this);
+        } else if (stats) {
+            stats->cacheHits.Add();
         }
+    }
 
-        virtual std::string GetText() const override {
-            return '=' + formula_->GetExpression();
-        }
-
-        std::vector<Position> GetReferencedCells() const {
-            return formula_->GetReferencedCells();
-        }
-    private:
-        SheetInterface& sheet_;
-        std::unique_ptr<FormulaInterface> formula_;
+    // Поля упорядочены так, чтобы между ними не было выравнивания: ячейка
+    // занимает 72 байта
+    Sheet& sheet_;
+    // Позиция ячейки; номера строки и столбца помещаются в 16 бит
+    uint16_t ownRow_;
+    uint16_t ownCol_;
+    int order_ = 0;
+    // Содержимое определяется kind_
+    union {
+        PooledString text_;
+        FormulaInterface* formula_;
     };
+    // Кэш значения формулы или числового значения текста; поле
+    // определяется cacheState_
+    mutable union {
+        double number;
+        FormulaError::Category error;
+    } cachedValue_;
+    mutable uint32_t changedAt_ = 0;
+    mutable uint32_t verifiedAt_ = 0;
+    DependencyGraph::NodeId nodeId_ = DependencyGraph::NO_NODE;
+    mutable CacheState cacheState_ = CacheState::Empty;
+    Kind kind_ = Kind::Empty;
+    bool queued_ = false;
+};
 
-    void Unregister() const;
-    void Register() const;
-    bool IsIndependent(const std::vector<Position>& cellPositions);
-
-    Sheet& sheet_;
-    Position ownPosition_;
-    std::unique_ptr<Impl> impl_;
-    mutable std::optional<Value> cachedValue_;
-    mutable std::unordered_set<Position, PositionHasher> dependencesUp_;
-    std::vector<Position> dependencesDown_;
+static_assert(Position::MAX_ROWS <= 65536 && Position::MAX_COLS <= 65536,
+              "cell position must fit 16-bit fields");
+static_assert(sizeof(void*) != 8 || sizeof(Cell) == 72, "cell must stay compact");
 
-};
+inline const Cell* Sheet::FindCell(Position pos) const {
+    return cells_.Get(pos);
+}
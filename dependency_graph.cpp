@@ -0,0 +1,100 @@
+#include "dependency_graph.h"
+
+#include <algorithm>
+
+namespace {
+
+// Массивы перестраиваются, когда накопленных изменений больше этого числа
+// и больше половины рёбер в сжатых массивах
+const size_t MIN_CHANGES_TO_COMPACT = 1024;
+
+}  // namespace
+
+DependencyGraph::NodeId DependencyGraph::AddNode(Position pos) {
+    if (!freeNodes_.empty()) {
+        const NodeId node = freeNodes_.back();
+        freeNodes_.pop_back();
+        positions_[node] = pos;
+        return node;
+    }
+    positions_.push_back(pos);
+    dependentCounts_.push_back(0);
+    return static_cast<NodeId>(positions_.size() - 1);
+}
+
+void DependencyGraph::RemoveNode(NodeId node) {
+    positions_[node] = Position::NONE;
+    freeNodes_.push_back(node);
+}
+
+void DependencyGraph::AddEdge(NodeId from, NodeId to) {
+    addedEdges_[from].push_back(to);
+    ++dependentCounts_[from];
+    if (++addedEdgeCount_ + removedEdgeCount_ > std::max(MIN_CHANGES_TO_COMPACT, edges_.size() / 2)) {
+        Compact();
+    }
+}
+
+void DependencyGraph::RemoveEdge(NodeId from, NodeId to) {
+    if (auto it = addedEdges_.find(from); it != addedEdges_.end()) {
+        auto& added = it->second;
+        if (auto edge = std::find(added.begin(), added.end(), to); edge != added.end()) {
+            *edge = added.back();
+            added.pop_back();
+            if (added.empty()) {
+                addedEdges_.erase(it);
+            }
+            --addedEdgeCount_;
+            --dependentCounts_[from];
+            return;
+        }
+    }
+    if (from + 1 >= offsets_.size()) {
+        return;
+    }
+    auto begin = edges_.begin() + offsets_[from];
+    auto end = edges_.begin() + offsets_[from + 1];
+    if (auto edge = std::find(begin, end, to); edge != end) {
+        *edge = NO_NODE;
+        --dependentCounts_[from];
+        if (++removedEdgeCount_ + addedEdgeCount_ > std::max(MIN_CHANGES_TO_COMPACT, edges_.size() / 2)) {
+            Compact();
+        }
+    }
+}
+
+size_t DependencyGraph::GetMemoryUsage() const {
+    // Узел хеш-таблицы хранит указатель на следующий узел, ключ и вектор
+    const size_t addedNodeSize = sizeof(void*) + sizeof(NodeId) + sizeof(std::vector<NodeId>);
+    size_t result = positions_.capacity() * sizeof(Position)
+            + dependentCounts_.capacity() * sizeof(uint32_t)
+            + freeNodes_.capacity() * sizeof(NodeId)
+            + offsets_.capacity() * sizeof(uint32_t)
+            + edges_.capacity() * sizeof(NodeId)
+            + addedEdges_.bucket_count() * sizeof(void*)
+            + addedEdges_.size() * addedNodeSize;
+    for (const auto& [node, added] : addedEdges_) {
+        result += added.capacity() * sizeof(NodeId);
+    }
+    return result;
+}
+
+void DependencyGraph::Compact() {
+    const size_t nodeCount = positions_.size();
+    std::vector<uint32_t> offsets(nodeCount + 1, 0);
+    for (size_t node = 0; node < nodeCount; ++node) {
+        offsets[node + 1] = offsets[node] + dependentCounts_[node];
+    }
+    std::vector<NodeId> edges;
+    edges.reserve(offsets[nodeCount]);
+    for (size_t node = 0; node < nodeCount; ++node) {
+        ForEachDependent(static_cast<NodeId>(node), [&edges](NodeId dependent) {
+            edges.push_back(dependent);
+        });
+    }
+    offsets_ = std::move(offsets);
+    edges_ = std::move(edges);
+    addedEdges_.clear();
+    addedEdgeCount_ = 0;
+    removedEdgeCount_ = 0;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "bit_utils.h"
+#include "position.h"
+
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+// Граф зависимостей таблицы: для каждой вершины (позиции таблицы) хранится
+// список вершин, которые от неё зависят. Вершины нумеруются плотно, списки
+// лежат в сжатом виде (CSR): общий массив рёбер и смещения начала списка
+// каждой вершины, так что обход соседей - линейное чтение памяти.
+// Изменения накапливаются отдельно: удалённое ребро помечается в общем
+// массиве, добавленные рёбра хранятся в дополнительном списке вершины.
+// Когда изменений становится много, массивы перестраиваются целиком.
+class DependencyGraph {
+public:
+    using NodeId = uint32_t;
+    static const NodeId NO_NODE = std::numeric_limits<NodeId>::max();
+
+    // Множество вершин: по биту на каждый номер вершины
+    class NodeSet {
+    public:
+        explicit NodeSet(size_t nodeLimit)
+            : words_((nodeLimit + 63) / 64, 0) {
+        }
+
+        // Добавляет вершину; возвращает false, если она уже была в множестве
+        bool Insert(NodeId node) {
+            uint64_t& word = words_[node / 64];
+            const uint64_t bit = uint64_t{1} << (node % 64);
+            if (word & bit) {
+                return false;
+            }
+            word |= bit;
+            return true;
+        }
+
+        // Вызывает visitor(NodeId) для вершин по возрастанию номеров
+        template <typename Visitor>
+        void ForEach(Visitor&& visitor) const {
+            for (size_t i = 0; i < words_.size(); ++i) {
+                for (uint64_t bits = words_[i]; bits != 0; bits &= bits - 1) {
+                    visitor(static_cast<NodeId>(i * 64 + LowestBit(bits)));
+                }
+            }
+        }
+
+    private:
+        std::vector<uint64_t> words_;
+    };
+
+    // Создаёт вершину для позиции, повторно используя освободившиеся номера
+    NodeId AddNode(Position pos);
+    // Освобождает номер вершины; от вершины не должны зависеть другие
+    void RemoveNode(NodeId node);
+
+    Position GetPosition(NodeId node) const {
+        return positions_[node];
+    }
+
+    // Граница номеров вершин: все номера меньше неё
+    size_t GetNodeLimit() const {
+        return positions_.size();
+    }
+
+    // Регистрирует зависимость вершины to от вершины from и отменяет её
+    void AddEdge(NodeId from, NodeId to);
+    void RemoveEdge(NodeId from, NodeId to);
+
+    size_t GetDependentCount(NodeId node) const {
+        return dependentCounts_[node];
+    }
+
+    // Вызывает visitor(NodeId) для каждой вершины, зависящей от node
+    template <typename Visitor>
+    void ForEachDependent(NodeId node, Visitor&& visitor) const {
+        if (dependentCounts_[node] == 0) {
+            return;
+        }
+        if (node + 1 < offsets_.size()) {
+            for (uint32_t i = offsets_[node]; i < offsets_[node + 1]; ++i) {
+                if (edges_[i] != NO_NODE) {
+                    visitor(edges_[i]);
+                }
+            }
+        }
+        if (auto it = addedEdges_.find(node); it != addedEdges_.end()) {
+            for (const NodeId dependent : it->second) {
+                visitor(dependent);
+            }
+        }
+    }
+
+    size_t GetMemoryUsage() const;
+
+private:
+    // Перестраивает сжатые массивы, включая в них накопленные изменения
+    void Compact();
+
+    std::vector<Position> positions_;
+    std::vector<uint32_t> dependentCounts_;
+    std::vector<NodeId> freeNodes_;
+
+    // Сжатые списки: рёбра вершины node занимают edges_[offsets_[node],
+    // offsets_[node + 1]); удалённые рёбра помечены NO_NODE. Вершины,
+    // созданные после перестроения, в offsets_ не входят.
+    std::vector<uint32_t> offsets_;
+    std::vector<NodeId> edges_;
+    // Рёбра, добавленные после перестроения
+    std::unordered_map<NodeId, std::vector<NodeId>> addedEdges_;
+    size_t addedEdgeCount_ = 0;
+    size_t removedEdgeCount_ = 0;
+};
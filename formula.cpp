@@ -11,6 +11,11 @@
 using namespace std::literals;
 
 namespace {
+// Значение ячейки для формулы; отсутствующая ячейка - ноль
+FormulaInterface::Value CellValue(const Cell* cell) {
+    return cell ? cell->GetArgumentValue() : 0.0;
+}
+
 class Formula : public FormulaInterface {
 public:
     explicit Formula(std::string expression)
@@ -18,33 +23,21 @@ public:
 
     }
     Value Evaluate(const SheetInterface& sheet) const override {
-        auto func = [&sheet](Position pos) {
-            CellInterface::Value value = sheet.GetCell(pos)->GetValue();
-            if (std::holds_alternative<double>(value)) {
-                return std::get<double>(value);
-            } else if (std::holds_alternative<std::string>(value)) {
-                std::string string_value = sheet.GetCell(pos)->GetText();
-                if (string_value[0] == '\'') {
-                    throw FormulaError(FormulaError::Category::Value);
-                }
-                try {
-                    return std::stod(string_value);
-                }  catch (...) {
-                    throw FormulaError(FormulaError::Category::Value);
-                }
-            } else if (std::holds_alternative<FormulaError>(value)) {
-                throw std::get<FormulaError>(value);
-            } else {
-                throw std::runtime_error("Cell lookup error"s);
-            }
-        };
-        Value tmp;
-        try {
-            tmp = ast_.Execute(func);
-        }  catch (FormulaError& e) {
-            tmp = e;
+        // Ошибки возвращаются как значения: каскад ошибок по таблице не
+        // должен стоить раскрутки стека на каждой ячейке
+        if (const auto* concreteSheet = dynamic_cast<const Sheet*>(&sheet)) {
+            return Evaluate(*concreteSheet);
         }
-        return tmp;
+        return ast_.Run([&sheet](Position pos) {
+            return CellValue(dynamic_cast<const Cell*>(sheet.GetCell(pos)));
+        });
+    }
+
+    Value Evaluate(const Sheet& sheet) const override {
+        // Позиции в формуле проверены при разборе
+        return ast_.Run([&sheet](Position pos) {
+            return CellValue(sheet.FindCell(pos));
+        });
     }
     std::string GetExpression() const override {
         std::stringstream out;
@@ -53,14 +46,84 @@ public:
     }
 
     virtual std::vector<Position> GetReferencedCells() const override {
-        return {ast_.GetCells().begin(), ast_.GetCells().end()};
+        return ast_.GetCells();
+    }
+
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this) + ast_.GetMemoryUsage();
     }
 
 private:
     FormulaAST ast_;
 };
+
+// Формула из пула: разобранное выражение со ссылками относительно ячейки
+// формулы общее для всех формул с таким же ключом, своя только позиция
+class SharedFormula : public FormulaInterface {
+public:
+    SharedFormula(FormulaPool& pool, FormulaPool::Entry* entry, Position origin)
+        : pool_(pool), entry_(entry), origin_(origin) {
+    }
+    SharedFormula(const SharedFormula&) = delete;
+    SharedFormula& operator=(const SharedFormula&) = delete;
+
+    ~SharedFormula() override {
+        pool_.Release(entry_);
+    }
+
+    Value Evaluate(const SheetInterface& sheet) const override {
+        if (const auto* concreteSheet = dynamic_cast<const Sheet*>(&sheet)) {
+            return Evaluate(*concreteSheet);
+        }
+        return entry_->value->Run([this, &sheet](Position offset) {
+            return CellValue(dynamic_cast<const Cell*>(sheet.GetCell(ToAbsolute(offset))));
+        });
+    }
+
+    Value Evaluate(const Sheet& sheet) const override {
+        return entry_->value->Run([this, &sheet](Position offset) {
+            return CellValue(sheet.FindCell(ToAbsolute(offset)));
+        });
+    }
+
+    std::string GetExpression() const override {
+        std::stringstream out;
+        entry_->value->PrintFormula(out, origin_);
+        return out.str();
+    }
+
+    std::vector<Position> GetReferencedCells() const override {
+        // Сдвиг сохраняет порядок ячеек
+        const std::vector<Position>& offsets = entry_->value->GetCells();
+        std::vector<Position> result;
+        result.reserve(offsets.size());
+        for (const Position offset : offsets) {
+            result.push_back(ToAbsolute(offset));
+        }
+        return result;
+    }
+
+    // Разобранное выражение учитывается в памяти пула
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this);
+    }
+
+private:
+    Position ToAbsolute(Position offset) const {
+        return {origin_.row + offset.row, origin_.col + offset.col};
+    }
+
+    FormulaPool& pool_;
+    FormulaPool::Entry* entry_;
+    Position origin_;
+};
 }  // namespace
 
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
     return std::make_unique<Formula>(std::move(expression));
 }
+
+std::unique_ptr<FormulaInterface> ParseFormula(std::string_view expression, Position pos, FormulaPool& pool) {
+    FormulaPool::Entry* entry = pool.Acquire(expression, pos);
+    return std::make_unique<SharedFormula>(pool, entry, pos);
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "errors.h"
+#include "formula_pool.h"
 #include "sheet.h"
 
 #include <memory>
@@ -27,6 +28,9 @@ public:
     // возвращается именно эта ошибка. Если таких ошибок несколько, возвращается
     // любая.
     virtual Value Evaluate(const SheetInterface& sheet) const = 0;
+    // То же для таблицы Sheet: ячейки читаются из неё напрямую, без
+    // виртуальных вызовов и приведения типов на каждую ссылку
+    virtual Value Evaluate(const Sheet& sheet) const = 0;
 
     // Возвращает выражение, которое описывает формулу.
     // Не содержит пробелов и лишних скобок.
@@ -36,8 +40,18 @@ public:
     // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Возвращает оценку памяти, занимаемой формулой, в байтах.
+    virtual size_t GetMemoryUsage() const = 0;
 };
 
 // Парсит переданное выражение и возвращает объект формулы.
 // Бросает FormulaException в случае, если формула синтаксически некорректна.
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+
+// Парсит выражение формулы, записанной в ячейку pos. Формулы, которые
+// отличаются только сдвигом ссылок относительно своей ячейки, разделяют
+// одно разобранное выражение из pool; текст и список ячеек формулы
+// вычисляются по нему при обращении.
+// Бросает исключение, если формула синтаксически некорректна.
+std::unique_ptr<FormulaInterface> ParseFormula(std::string_view expression, Position pos, FormulaPool& pool);
@@ -0,0 +1,91 @@
+#include "formula_pool.h"
+
+#include "FormulaAST.h"
+
+#include <cctype>
+#include <string>
+
+namespace {
+
+bool IsUpper(char c) {
+    return c >= 'A' && c <= 'Z';
+}
+
+bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Может ли символ продолжать лексему ссылки или числа
+bool IsWordChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '.';
+}
+
+// Ключ выражения из ячейки pos: ссылки заменяются сдвигами относительно
+// pos, остальные символы сохраняются. Заменяются только отдельно стоящие
+// лексемы вида [A-Z]+[0-9]+ с допустимой позицией: лексер разбирает их как
+// ссылку, поэтому выражения с одинаковым ключом разбираются одинаково.
+// Сдвиг записывается после нулевого символа, а сам нулевой символ
+// удваивается, чтобы ключи не совпадали с текстом других выражений.
+std::string MakeKey(std::string_view expression, Position pos) {
+    std::string key;
+    key.reserve(expression.size() + 8);
+    size_t i = 0;
+    while (i < expression.size()) {
+        const char c = expression[i];
+        if (IsUpper(c) && (i == 0 || !IsWordChar(expression[i - 1]))) {
+            size_t end = i;
+            while (end < expression.size() && IsUpper(expression[end])) {
+                ++end;
+            }
+            const size_t lettersEnd = end;
+            while (end < expression.size() && IsDigit(expression[end])) {
+                ++end;
+            }
+            if (end > lettersEnd && (end == expression.size() || !IsWordChar(expression[end]))) {
+                const Position cell = Position::FromString(expression.substr(i, end - i));
+                if (cell.IsValid()) {
+                    key += '\0';
+                    key += std::to_string(cell.row - pos.row);
+                    key += ':';
+                    key += std::to_string(cell.col - pos.col);
+                    key += ';';
+                    i = end;
+                    continue;
+                }
+            }
+            key.append(expression.substr(i, end - i));
+            i = end;
+            continue;
+        }
+        if (c == '\0') {
+            key += '\0';
+        }
+        key += c;
+        ++i;
+    }
+    return key;
+}
+
+}  // namespace
+
+FormulaPool::FormulaPool() = default;
+
+FormulaPool::~FormulaPool() = default;
+
+FormulaPool::Entry* FormulaPool::Acquire(std::string_view expression, Position pos) {
+    return entries_.Acquire(MakeKey(expression, pos), [expression, pos] {
+        FormulaAST ast = ParseFormulaAST(std::string(expression));
+        ast.MoveCells(-pos.row, -pos.col);
+        return std::make_unique<const FormulaAST>(std::move(ast));
+    });
+}
+
+void FormulaPool::Release(Entry* entry) {
+    entries_.Release(entry);
+}
+
+size_t FormulaPool::GetMemoryUsage() const {
+    return entries_.GetMemoryUsage([](const std::unique_ptr<const FormulaAST>& ast) {
+        return sizeof(FormulaAST) + ast->GetMemoryUsage();
+    });
+}
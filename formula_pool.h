@@ -0,0 +1,43 @@
+#pragma once
+
+#include "intern_table.h"
+#include "position.h"
+
+#include <memory>
+#include <string_view>
+
+class FormulaAST;
+
+// Пул разобранных формул с подсчётом ссылок. Формулы, которые отличаются
+// только сдвигом ссылок относительно своей ячейки (=A1*B1 в C1, =A2*B2 в
+// C2, ...), разбираются один раз и хранят одно синтаксическое дерево со
+// ссылками относительно ячейки формулы. Записи удаляются, когда на них не
+// остаётся ссылок.
+class FormulaPool {
+public:
+    // Ключ записи - текст формулы, в котором ссылки заменены сдвигами,
+    // значение - формула со ссылками относительно ячейки формулы
+    using Entry = InternTable<std::unique_ptr<const FormulaAST>>::Entry;
+
+    FormulaPool();
+    FormulaPool(const FormulaPool&) = delete;
+    FormulaPool& operator=(const FormulaPool&) = delete;
+    ~FormulaPool();
+
+    // Запись для выражения формулы из ячейки pos. Выражение разбирается,
+    // только если записи с такими же относительными ссылками ещё нет.
+    // Бросает исключения разбора для некорректного выражения.
+    Entry* Acquire(std::string_view expression, Position pos);
+    void Release(Entry* entry);
+
+    // Количество различных формул в пуле
+    size_t Size() const {
+        return entries_.Size();
+    }
+
+    // Оценка памяти, занимаемой пулом, вместе с деревьями формул
+    size_t GetMemoryUsage() const;
+
+private:
+    InternTable<std::unique_ptr<const FormulaAST>> entries_;
+};
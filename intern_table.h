@@ -0,0 +1,74 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+// Таблица записей с подсчётом ссылок, найденных по строковому ключу. Запись
+// с данным ключом существует в единственном экземпляре и удаляется, когда
+// на неё не остаётся ссылок. Адрес записи не меняется, пока она существует.
+template <typename Value>
+class InternTable {
+public:
+    struct Entry {
+        std::string key;
+        Value value;
+        size_t refCount = 0;
+    };
+
+    InternTable() = default;
+    InternTable(const InternTable&) = delete;
+    InternTable& operator=(const InternTable&) = delete;
+
+    // Запись с ключом key. Если её нет, она создаётся со значением
+    // makeValue(); исключение из makeValue() оставляет таблицу без изменений.
+    template <typename MakeValue>
+    Entry* Acquire(std::string_view key, MakeValue&& makeValue) {
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            auto entry = std::make_unique<Entry>(Entry{std::string(key), makeValue(), 0});
+            std::string_view entryKey = entry->key;
+            it = entries_.emplace(entryKey, std::move(entry)).first;
+        }
+        ++it->second->refCount;
+        return it->second.get();
+    }
+
+    void Release(Entry* entry) {
+        if (--entry->refCount == 0) {
+            // ключ ссылается на удаляемую запись, поэтому удаление по итератору
+            entries_.erase(entries_.find(entry->key));
+        }
+    }
+
+    // Количество различных ключей
+    size_t Size() const {
+        return entries_.size();
+    }
+
+    // Оценка памяти, занимаемой таблицей: записи, ключи вне самих записей,
+    // узлы и корзины хеш-таблицы, а также valueMemory(value) для каждого
+    // значения - память, которую значение занимает вне записи
+    template <typename ValueMemory>
+    size_t GetMemoryUsage(ValueMemory&& valueMemory) const {
+        static const std::string EMPTY;
+        if (entries_.empty()) {
+            return 0;
+        }
+        const size_t nodeSize = sizeof(void*) + sizeof(std::string_view) + sizeof(std::unique_ptr<Entry>);
+        size_t result = entries_.bucket_count() * sizeof(void*);
+        for (const auto& [key, entry] : entries_) {
+            result += nodeSize + sizeof(Entry) + valueMemory(entry->value);
+            if (entry->key.capacity() > EMPTY.capacity()) {
+                result += entry->key.capacity() + 1;
+            }
+        }
+        return result;
+    }
+
+private:
+    // Ключ ссылается на текст, хранящийся в самой записи
+    std::unordered_map<std::string_view, std::unique_ptr<Entry>> entries_;
+};
@@ -1,8 +1,13 @@
 #include "position.h"
 #include "sheet.h"
 #include "cell.h"
+#include "FormulaAST.h"
 #include "test_runner_p.h"
 
+#include <cmath>
+#include <functional>
+#include <random>
+
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
     return output << "(" << pos.row << ", " << pos.col << ")";
 }
@@ -84,6 +89,54 @@ void TestClearCell() {
     sheet->ClearCell("J10"_pos);
 }
 
+void TestCellsAcrossTiles() {
+    auto sheet = CreateSheet();
+    const Position positions[] = {{0, 0}, {63, 63}, {64, 64}, {0, 127}, {200, 3},
+                                  {Position::MAX_ROWS - 1, Position::MAX_COLS - 1}};
+    for (Position pos : positions) {
+        sheet->SetCell(pos, pos.ToString());
+    }
+    for (Position pos : positions) {
+        ASSERT(sheet->GetCell(pos) != nullptr);
+        ASSERT_EQUAL(sheet->GetCell(pos)->GetText(), pos.ToString());
+    }
+    ASSERT(sheet->GetCell(Position{1, 1}) == nullptr);
+    ASSERT(sheet->GetCell(Position{64, 63}) == nullptr);
+
+    sheet->ClearCell(Position{64, 64});
+    ASSERT(sheet->GetCell(Position{64, 64}) == nullptr);
+    sheet->SetCell(Position{64, 64}, "again");
+    ASSERT_EQUAL(sheet->GetCell(Position{64, 64})->GetText(), "again");
+}
+
+void TestSpareTiles() {
+    // Опустевшие блоки откладываются и выдаются снова, последний
+    // отложенный - первым, в том числе для другой области таблицы
+    TileStorage<int> storage;
+    int* first = &storage.Emplace(Position{0, 0}, 1);
+    int* second = &storage.Emplace(Position{64, 0}, 2);
+    storage.Erase(Position{0, 0});
+    storage.Erase(Position{64, 0});
+    ASSERT(&storage.Emplace(Position{3 * 64, 5 * 64}, 3) == second);
+    ASSERT(&storage.Emplace(Position{5 * 64, 3 * 64}, 4) == first);
+
+    // Повторные правки ячеек в разных блоках не выделяют новых блоков
+    Sheet sheet;
+    const Position positions[] = {{0, 0}, {100, 100}, {300, 5}, {7, 900}};
+    auto round = [&]() {
+        for (Position pos : positions) {
+            sheet.SetCell(pos, "text");
+            sheet.ClearCell(pos);
+        }
+    };
+    round();
+    const size_t storageSize = sheet.GetMemoryStats().storage;
+    for (int i = 0; i < 1000; ++i) {
+        round();
+    }
+    ASSERT_EQUAL(sheet.GetMemoryStats().storage, storageSize);
+}
+
 void TestPrint() {
     auto sheet = CreateSheet();
     sheet->SetCell("A2"_pos, "meow");
@@ -104,6 +157,70 @@ void TestPrint() {
     ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{2, 1}));
 }
 
+void TestPrintSparse() {
+    auto sheet = CreateSheet();
+    sheet->SetCell(Position{0, 1}, "x");
+    sheet->SetCell(Position{2, 70}, "=1/4");
+    sheet->SetCell(Position{70, 0}, "'y");
+
+    std::string expectedTexts;
+    std::string expectedValues;
+    for (int row = 0; row < 71; ++row) {
+        for (int col = 0; col < 71; ++col) {
+            if (col != 0) {
+                expectedTexts += '\t';
+                expectedValues += '\t';
+            }
+            if (row == 0 && col == 1) {
+                expectedTexts += "x";
+                expectedValues += "x";
+            } else if (row == 2 && col == 70) {
+                expectedTexts += "=1/4";
+                expectedValues += "0.25";
+            } else if (row == 70 && col == 0) {
+                expectedTexts += "'y";
+                expectedValues += "y";
+            }
+        }
+        expectedTexts += '\n';
+        expectedValues += '\n';
+    }
+
+    std::ostringstream texts;
+    sheet->PrintTexts(texts);
+    ASSERT_EQUAL(texts.str(), expectedTexts);
+
+    std::ostringstream values;
+    sheet->PrintValues(values);
+    ASSERT_EQUAL(values.str(), expectedValues);
+}
+
+void TestPrintableSizeAfterClear() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "a");
+    sheet->SetCell("C5"_pos, "c");
+    sheet->SetCell("E2"_pos, "e");
+    sheet->SetCell("C2"_pos, "c");
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{5, 5}));
+
+    sheet->ClearCell("E2"_pos);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{5, 3}));
+    sheet->ClearCell("C5"_pos);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{2, 3}));
+    sheet->SetCell("C2"_pos, "again");
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{2, 3}));
+    sheet->ClearCell("C2"_pos);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{1, 1}));
+    sheet->ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{0, 0}));
+
+    const Position farCorner{Position::MAX_ROWS - 1, Position::MAX_COLS - 1};
+    sheet->SetCell(farCorner, "far");
+    sheet->SetCell("B2"_pos, "near");
+    sheet->ClearCell(farCorner);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{2, 2}));
+}
+
 void TestExpressions() {
     auto sheet = CreateSheet();
     sheet->SetCell("A1"_pos, "1");
@@ -203,6 +320,842 @@ void TestErrors() {
 
 
 
+void TestUpdateInPlace() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("B1"_pos, "=A1+1");
+    sheet->SetCell("C1"_pos, "=B1*A1");
+    const CellInterface* a1 = sheet->GetCell("A1"_pos);
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(2.0));
+
+    sheet->SetCell("A1"_pos, "5");
+    ASSERT(sheet->GetCell("A1"_pos) == a1);
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(6.0));
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(30.0));
+
+    sheet->SetCell("A1"_pos, "=2*3");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(42.0));
+
+    try {
+        sheet->SetCell("A1"_pos, "=C1");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "=2*3");
+
+    sheet->ClearCell("A1"_pos);
+    ASSERT(sheet->GetCell("A1"_pos) == nullptr);
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(0.0));
+    sheet->SetCell("A1"_pos, "2");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(6.0));
+
+    try {
+        sheet->SetCell("D4"_pos, "=D4");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT(sheet->GetCell("D4"_pos) == nullptr);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{1, 3}));
+}
+
+void TestSharedTexts() {
+    Sheet sheet;
+    const std::string label = "a label that is too long to be stored inline";
+    for (int row = 0; row < 100; ++row) {
+        sheet.SetCell(Position{row, 0}, label);
+        sheet.SetCell(Position{row, 1}, "'short");
+    }
+    ASSERT_EQUAL(sheet.GetStringPool().Size(), 1u);
+
+    const auto* cell = dynamic_cast<const Cell*>(sheet.GetCell(Position{42, 1}));
+    ASSERT(std::get<std::string_view>(cell->GetValueView()) == "short");
+    ASSERT(cell->GetTextView() == "'short");
+    ASSERT_EQUAL(sheet.GetCell(Position{42, 0})->GetValue(), CellInterface::Value(label));
+
+    sheet.SetCell(Position{0, 0}, label + "!");
+    ASSERT_EQUAL(sheet.GetStringPool().Size(), 2u);
+    for (int row = 0; row < 100; ++row) {
+        sheet.ClearCell(Position{row, 0});
+    }
+    ASSERT_EQUAL(sheet.GetStringPool().Size(), 0u);
+}
+
+void TestMemoryStats() {
+    Sheet sheet;
+    const MemoryStats empty = sheet.GetMemoryStats();
+    ASSERT_EQUAL(empty.formulas, 0u);
+
+    sheet.SetCell("A1"_pos, "1");
+    const MemoryStats text = sheet.GetMemoryStats();
+    ASSERT(text.storage > empty.storage);
+    ASSERT_EQUAL(text.formulas, 0u);
+
+    sheet.SetCell("B1"_pos, "=A1+A2*3");
+    sheet.SetCell("C1"_pos, std::string(100, 'x'));
+    const MemoryStats full = sheet.GetMemoryStats();
+    ASSERT(full.formulas > 0);
+    ASSERT(full.dependencyGraph > empty.dependencyGraph);
+    ASSERT(full.strings > empty.strings + 100);
+    ASSERT(full.caches > text.caches);
+    ASSERT_EQUAL(full.Total(), full.storage + full.dependencyGraph + full.formulas
+                 + full.caches + full.strings);
+}
+
+void TestReferencedEmptyCells() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "=C3+D4*2");
+    ASSERT(sheet->GetCell("C3"_pos) == nullptr);
+    ASSERT(sheet->GetCell("D4"_pos) == nullptr);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{1, 1}));
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+    sheet->SetCell("D4"_pos, "5");
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(10.0));
+    try {
+        sheet->SetCell("C3"_pos, "=A1");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT(sheet->GetCell("C3"_pos) == nullptr);
+
+    sheet->SetCell("C3"_pos, "1");
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(11.0));
+    sheet->ClearCell("D4"_pos);
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(1.0));
+
+    sheet->SetCell("A1"_pos, "text");
+    sheet->SetCell("D4"_pos, "7");
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value("text"s));
+}
+
+void TestSetCells() {
+    {
+        auto sheet = std::make_unique<Sheet>();
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("C1"_pos, "=A1*10");
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(10.0));
+
+        sheet->SetCells({{"B1"_pos, "=A1+A2"}, {"A2"_pos, "=A1+1"}, {"A1"_pos, "2"},
+                         {"D1"_pos, "text"}, {"D1"_pos, "'text"}});
+        ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(5.0));
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(20.0));
+        ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value("text"s));
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{2, 4}));
+    }
+
+    {
+        auto sheet = std::make_unique<Sheet>();
+        sheet->SetCell("E1"_pos, "=A1");
+        try {
+            sheet->SetCells({{"A1"_pos, "=B1"}, {"B1"_pos, "=A1"}, {"C1"_pos, "=C1"},
+                             {"D1"_pos, "=A1+E1"}, {"F1"_pos, "5"}});
+            ASSERT(false);
+        } catch (const CircularDependencyException& e) {
+            ASSERT_EQUAL(std::string(e.what()), "Circular dependency found: A1 B1 C1");
+        }
+        ASSERT(sheet->GetCell("F1"_pos) == nullptr);
+        ASSERT(sheet->GetCell("B1"_pos) == nullptr);
+
+        try {
+            sheet->SetCells({{"A1"_pos, "1"}, {"B1"_pos, "=A1+*"}});
+            ASSERT(false);
+        } catch (const FormulaException&) {
+        }
+        ASSERT(sheet->GetCell("B1"_pos) == nullptr);
+    }
+
+    // Пакет, ячейки которого связаны через ячейки вне пакета
+    {
+        auto sheet = std::make_unique<Sheet>();
+        sheet->SetCell("B1"_pos, "=A2");
+        sheet->SetCell("B2"_pos, "=D2");
+        sheet->SetCell("A2"_pos, "1");
+        sheet->SetCell("A5"_pos, "1");
+        sheet->SetCells({{"D2"_pos, "=B1*10"}, {"A2"_pos, "=A5+1"}});
+        ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(20.0));
+        sheet->SetCell("A5"_pos, "2");
+        ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(30.0));
+        try {
+            sheet->SetCell("B1"_pos, "=B2");
+            ASSERT(false);
+        } catch (const CircularDependencyException&) {
+        }
+        ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetText(), "=A2");
+    }
+
+    // Случайные пакеты, ссылающиеся на ячейки в пакете и вне его: значения
+    // совпадают с таблицей, заполненной по одной ячейке, а отклонённый
+    // пакет не меняет таблицу
+    const int size = 4;
+    std::mt19937 random(7);
+    auto randomPosition = [&]() {
+        return Position{static_cast<int>(random() % size), static_cast<int>(random() % size)};
+    };
+    auto texts = [size](const Sheet& sheet) {
+        std::ostringstream out;
+        for (int row = 0; row < size; ++row) {
+            for (int col = 0; col < size; ++col) {
+                const CellInterface* cell = sheet.GetCell(Position{row, col});
+                out << (cell ? cell->GetText() : "-") << ';';
+            }
+        }
+        return out.str();
+    };
+    Sheet sheet;
+    for (int step = 0; step < 1000; ++step) {
+        std::vector<std::pair<Position, std::string>> batch;
+        for (int count = 1 + random() % 5; count > 0; --count) {
+            std::string text = std::to_string(random() % 10);
+            if (random() % 3 != 0) {
+                text = "=" + randomPosition().ToString() + "+" + text;
+            }
+            batch.emplace_back(randomPosition(), text);
+        }
+        const std::string before = texts(sheet);
+        try {
+            sheet.SetCells(batch);
+        } catch (const CircularDependencyException&) {
+            ASSERT_EQUAL(texts(sheet), before);
+        }
+
+        Sheet expected;
+        for (int row = 0; row < size; ++row) {
+            for (int col = 0; col < size; ++col) {
+                if (const CellInterface* cell = sheet.GetCell(Position{row, col})) {
+                    expected.SetCell(Position{row, col}, cell->GetText());
+                }
+            }
+        }
+        for (int row = 0; row < size; ++row) {
+            for (int col = 0; col < size; ++col) {
+                if (const CellInterface* cell = sheet.GetCell(Position{row, col})) {
+                    ASSERT_EQUAL(cell->GetValue(), expected.GetCell(Position{row, col})->GetValue());
+                }
+            }
+        }
+
+        // Последующая правка находит те же циклы
+        const Position pos = randomPosition();
+        const std::string text = "=" + randomPosition().ToString() + "+" + randomPosition().ToString();
+        bool hasCycle = false;
+        bool expectCycle = false;
+        try {
+            sheet.SetCell(pos, text);
+        } catch (const CircularDependencyException&) {
+            hasCycle = true;
+        }
+        try {
+            expected.SetCell(pos, text);
+        } catch (const CircularDependencyException&) {
+            expectCycle = true;
+        }
+        ASSERT_EQUAL(hasCycle, expectCycle);
+    }
+}
+
+void TestRecalculate() {
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("B1"_pos, "=A1+1");
+    sheet->SetCell("B2"_pos, "=A1*2");
+    sheet->SetCell("C1"_pos, "=B1+B2");
+    sheet->SetCell("D1"_pos, "=C1/A2");
+    sheet->Recalculate();
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(4.0));
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+
+    sheet->SetCell("A1"_pos, "2");
+    sheet->SetCell("A2"_pos, "=B2");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(1.75));
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(7.0));
+
+    sheet->SetCell("B1"_pos, "=A1-1");
+    sheet->ClearCell("B2"_pos);
+    sheet->Recalculate();
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+    ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), CellInterface::Value(0.0));
+}
+
+void TestLongChain() {
+    // Нарастающий итог, идущий по столбцам сверху вниз. Вычисление и сброс
+    // кэша не используют рекурсию, поэтому глубина цепочки не ограничена
+    // стеком
+    const int length = 200'000;
+    auto chainPosition = [](int i) {
+        return Position{i % Position::MAX_ROWS, i / Position::MAX_ROWS};
+    };
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell(chainPosition(0), "1");
+    for (int i = 1; i < length; ++i) {
+        sheet->SetCell(chainPosition(i), "=" + chainPosition(i - 1).ToString() + "+1");
+    }
+    const Position last = chainPosition(length - 1);
+    ASSERT_EQUAL(sheet->GetCell(last)->GetValue(), CellInterface::Value(double(length)));
+
+    sheet->SetCell(chainPosition(0), "2");
+    ASSERT_EQUAL(sheet->GetCell(last)->GetValue(), CellInterface::Value(double(length + 1)));
+
+    try {
+        sheet->SetCell(chainPosition(0), "=" + last.ToString());
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+}
+
+void TestParallelRecalculate() {
+    // Строки с входными данными в столбце A и несколько уровней формул,
+    // часть которых ссылается на соседние строки
+    const int rows = 2000;
+    auto fill = [rows](Sheet& sheet, int input) {
+        for (int row = 0; row < rows; ++row) {
+            const std::string r = std::to_string(row + 1);
+            const std::string next = std::to_string((row + 1) % rows + 1);
+            sheet.SetCell(Position{row, 0}, std::to_string(row % 7 + input));
+            sheet.SetCell(Position{row, 1}, "=A" + r + "*1.5+A" + next);
+            sheet.SetCell(Position{row, 2}, "=B" + r + "/(A" + r + "-3)");
+            sheet.SetCell(Position{row, 3}, "=C" + r + "+B" + next + "-C" + next);
+        }
+    };
+    Sheet serial;
+    Sheet parallel;
+    parallel.SetRecalcThreadCount(4);
+    parallel.EnableRecalcStats(true);
+    for (int input : {0, 2}) {
+        fill(serial, input);
+        fill(parallel, input);
+        parallel.ResetRecalcStats();
+        serial.Recalculate();
+        parallel.Recalculate();
+        if (input == 0) {
+            // Все формулы новые и вычисляются пересчётом
+            ASSERT_EQUAL(parallel.GetRecalcStats().evaluations.Get(), static_cast<uint64_t>(rows * 3));
+        }
+        std::ostringstream expected;
+        std::ostringstream actual;
+        serial.PrintValues(expected);
+        // Чтение после пересчёта берёт значения из кеша и ничего не вычисляет
+        parallel.ResetRecalcStats();
+        parallel.PrintValues(actual);
+        ASSERT_EQUAL(parallel.GetRecalcStats().evaluations.Get(), 0u);
+        ASSERT_EQUAL(parallel.GetRecalcStats().cacheMisses.Get(), 0u);
+        ASSERT(expected.str() == actual.str());
+    }
+}
+
+void TestTopologicalOrder() {
+    // Пакет, ячейки которого ссылаются на ячейки следующего пакета: порядок
+    // не должен позволить замкнуть цикл последующей правкой
+    {
+        Sheet sheet;
+        sheet.SetCell("D1"_pos, "3");
+        sheet.SetCells({{"D6"_pos, "=B6"}, {"B10"_pos, "1"}});
+        sheet.SetCells({{"B6"_pos, "=D1"}, {"D1"_pos, "=B10"}});
+        try {
+            sheet.SetCell("B10"_pos, "=D6");
+            ASSERT(false);
+        } catch (const CircularDependencyException&) {
+        }
+    }
+    // Ячейка пакета, до которой обратный поиск доходит через ячейку вне
+    // пакета (B1 -> A2 -> A5)
+    {
+        Sheet sheet;
+        sheet.SetCell("B1"_pos, "=A2");
+        sheet.SetCell("B2"_pos, "=D2");
+        sheet.SetCell("A2"_pos, "1");
+        sheet.SetCell("A5"_pos, "1");
+        sheet.SetCells({{"D2"_pos, "=B1"}, {"A2"_pos, "=A5"}});
+        try {
+            sheet.SetCell("B1"_pos, "=B2");
+            ASSERT(false);
+        } catch (const CircularDependencyException&) {
+        }
+    }
+
+    // Случайные правки небольшой таблицы отдельными ячейками и пакетами:
+    // циклы должны находиться так же, как полным обходом, а порядок
+    // ячеек - оставаться топологическим
+    const int size = 5;
+    std::mt19937 random(42);
+    auto randomPosition = [&]() {
+        return Position{static_cast<int>(random() % size), static_cast<int>(random() % size)};
+    };
+    auto randomText = [&]() {
+        switch (random() % 4) {
+        case 0:
+            return std::to_string(random() % 10);
+        case 1:
+            return "=" + randomPosition().ToString();
+        default:
+            return "=" + randomPosition().ToString() + "+" + randomPosition().ToString();
+        }
+    };
+    Sheet sheet;
+    for (int step = 0; step < 4000; ++step) {
+        const Position pos = randomPosition();
+        if (random() % 5 == 0) {
+            sheet.ClearCell(pos);
+            continue;
+        }
+        std::vector<std::pair<Position, std::string>> batch{{pos, randomText()}};
+        const bool isBatch = random() % 4 != 0;
+        if (isBatch) {
+            for (int count = random() % 6; count > 0; --count) {
+                batch.emplace_back(randomPosition(), randomText());
+            }
+        }
+
+        // Ссылки всех ячеек после правки; цикл ищется полным обходом
+        std::map<Position, std::vector<Position>> references;
+        for (int row = 0; row < size; ++row) {
+            for (int col = 0; col < size; ++col) {
+                if (const CellInterface* cell = sheet.GetCell(Position{row, col})) {
+                    references[Position{row, col}] = cell->GetReferencedCells();
+                }
+            }
+        }
+        for (const auto& [cellPos, text] : batch) {
+            references[cellPos] = text[0] == '=' ? ParseFormula(text.substr(1))->GetReferencedCells()
+                                                 : std::vector<Position>{};
+        }
+        std::function<bool(Position, Position, int)> reaches = [&](Position from, Position to, int depth) {
+            if (depth > 0 && from == to) {
+                return true;
+            }
+            if (depth > size * size) {
+                return false;
+            }
+            for (Position next : references[from]) {
+                if (reaches(next, to, depth + 1)) {
+                    return true;
+                }
+            }
+            return false;
+        };
+        bool expectCycle = false;
+        for (const auto& [cellPos, text] : batch) {
+            expectCycle = expectCycle || reaches(cellPos, cellPos, 0);
+        }
+
+        bool hasCycle = false;
+        try {
+            if (isBatch) {
+                sheet.SetCells(batch);
+            } else {
+                sheet.SetCell(pos, batch.front().second);
+            }
+        } catch (const CircularDependencyException&) {
+            hasCycle = true;
+        }
+        ASSERT_EQUAL(hasCycle, expectCycle);
+
+        for (int row = 0; row < size; ++row) {
+            for (int col = 0; col < size; ++col) {
+                const auto* cell = dynamic_cast<const Cell*>(sheet.GetCell(Position{row, col}));
+                if (!cell) {
+                    continue;
+                }
+                for (Position reference : cell->GetReferencedCells()) {
+                    if (const auto* referenced = dynamic_cast<const Cell*>(sheet.GetCell(reference))) {
+                        ASSERT(referenced->GetOrder() < cell->GetOrder());
+                    }
+                }
+            }
+        }
+    }
+}
+
+void TestRevisions() {
+    // Случайные правки с чтением отдельных ячеек и полными пересчётами:
+    // значения должны совпадать с таблицей, построенной заново
+    const int size = 4;
+    std::mt19937 random(7);
+    auto randomPosition = [&]() {
+        return Position{static_cast<int>(random() % size), static_cast<int>(random() % size)};
+    };
+    auto randomText = [&]() -> std::string {
+        switch (random() % 4) {
+        case 0:
+            return std::to_string(random() % 10);
+        case 1:
+            return "=" + randomPosition().ToString() + "+1";
+        case 2:
+            return "=" + randomPosition().ToString() + "*" + randomPosition().ToString();
+        default:
+            return "=" + randomPosition().ToString() + "/" + randomPosition().ToString();
+        }
+    };
+    auto rebuild = [size](const Sheet& sheet) {
+        auto copy = std::make_unique<Sheet>();
+        for (int row = 0; row < size; ++row) {
+            for (int col = 0; col < size; ++col) {
+                if (const CellInterface* cell = sheet.GetCell(Position{row, col})) {
+                    copy->SetCell(Position{row, col}, cell->GetText());
+                }
+            }
+        }
+        return copy;
+    };
+
+    Sheet sheet;
+    for (int step = 0; step < 3000; ++step) {
+        const Position pos = randomPosition();
+        switch (random() % 8) {
+        case 0:
+            sheet.ClearCell(pos);
+            break;
+        case 1:
+            try {
+                sheet.SetCells({{pos, randomText()}, {randomPosition(), randomText()}});
+            } catch (const CircularDependencyException&) {
+            }
+            break;
+        case 2:
+            sheet.Recalculate();
+            break;
+        default:
+            try {
+                sheet.SetCell(pos, randomText());
+            } catch (const CircularDependencyException&) {
+            }
+        }
+
+        const Position probe = randomPosition();
+        if (step % 50 == 0) {
+            std::ostringstream expected;
+            std::ostringstream actual;
+            rebuild(sheet)->PrintValues(expected);
+            sheet.PrintValues(actual);
+            ASSERT_EQUAL(actual.str(), expected.str());
+        } else if (const CellInterface* cell = sheet.GetCell(probe)) {
+            std::ostringstream expected;
+            std::ostringstream actual;
+            expected << rebuild(sheet)->GetCell(probe)->GetValue();
+            actual << cell->GetValue();
+            ASSERT_EQUAL(actual.str(), expected.str());
+        }
+    }
+}
+
+void TestRepeatedCreateAndErase() {
+    // Список изменённых позиций не растёт, когда одну и ту же ячейку
+    // создают и удаляют без пересчёта, и освобождается пересчётом
+    Sheet sheet;
+    sheet.SetCell("B1"_pos, "=A1+1");
+    sheet.SetCell("B2"_pos, "2");
+    auto round = [&sheet]() {
+        sheet.SetCell("A1"_pos, "1");
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+        sheet.ClearCell("A1"_pos);
+        sheet.SetCell("A2"_pos, "1");
+        sheet.ClearCell("A2"_pos);
+    };
+    round();
+    const MemoryStats first = sheet.GetMemoryStats();
+    for (int i = 0; i < 10000; ++i) {
+        round();
+    }
+    ASSERT_EQUAL(sheet.GetMemoryStats().dependencyGraph, first.dependencyGraph);
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(1.0));
+
+    sheet.Recalculate();
+    for (int row = 0; row < 5000; ++row) {
+        sheet.SetCell(Position{row, 3}, "1");
+        sheet.ClearCell(Position{row, 3});
+    }
+    ASSERT(sheet.GetMemoryStats().dependencyGraph > first.dependencyGraph);
+    sheet.Recalculate();
+    ASSERT(sheet.GetMemoryStats().dependencyGraph <= first.dependencyGraph);
+}
+
+void TestEarlyCutoff() {
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("B1"_pos, "=A1*0");
+    sheet->SetCell("C1"_pos, "=B1+1");
+    sheet->SetCell("D1"_pos, "=A1+C1");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(2.0));
+    auto changedAt = [&sheet](Position pos) {
+        return dynamic_cast<const Cell*>(sheet->GetCell(pos))->GetChangedAt();
+    };
+    const uint32_t computedAt = changedAt("C1"_pos);
+
+    // Значение B1 не меняется, поэтому C1 не пересчитывается ни при
+    // чтении, ни при полном пересчёте
+    sheet->SetCell("A1"_pos, "2");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(3.0));
+    ASSERT_EQUAL(changedAt("C1"_pos), computedAt);
+    sheet->SetCell("A1"_pos, "3");
+    sheet->Recalculate();
+    ASSERT_EQUAL(changedAt("C1"_pos), computedAt);
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(4.0));
+
+    // 0 и -0 выводятся по-разному и считаются разными значениями
+    const uint32_t zeroAt = changedAt("B1"_pos);
+    sheet->SetCell("A1"_pos, "-3");
+    std::ostringstream output;
+    sheet->PrintValues(output);
+    ASSERT_EQUAL(output.str(), "-3\t-0\t1\t-2\n");
+    ASSERT(changedAt("B1"_pos) != zeroAt);
+}
+
+void TestDependencyGraph() {
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("A2"_pos, "2");
+    sheet->SetCell("B1"_pos, "=A1*10");
+    sheet->SetCell("B2"_pos, "=B1+A1");
+
+    // Частая смена ссылок накапливает изменения графа и приводит к его
+    // перестроению; зависимости при этом не теряются
+    for (int i = 0; i < 5000; ++i) {
+        sheet->SetCell("B1"_pos, i % 2 == 0 ? "=A2*10" : "=A1*10");
+    }
+    ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(11.0));
+    sheet->SetCell("A1"_pos, "3");
+    ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(33.0));
+    sheet->SetCell("A2"_pos, "4");
+    sheet->Recalculate();
+    ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(33.0));
+
+    // Вершина удалённой ячейки сохраняется, пока на позицию ссылаются
+    sheet->ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(0.0));
+    sheet->SetCell("A1"_pos, "5");
+    sheet->Recalculate();
+    ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(55.0));
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(50.0));
+}
+
+void TestPrecedentsAndDependents() {
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("B1"_pos, "=A1+A2");
+    sheet->SetCell("C1"_pos, "=B1*2");
+    sheet->SetCell("D1"_pos, "=C1+B1");
+    sheet->SetCell("A3"_pos, "=Z100");
+    using Positions = std::vector<Position>;
+
+    ASSERT_EQUAL(sheet->GetPrecedents("D1"_pos, false), (Positions{"B1"_pos, "C1"_pos}));
+    ASSERT_EQUAL(sheet->GetPrecedents("D1"_pos, true), (Positions{"A1"_pos, "B1"_pos, "C1"_pos, "A2"_pos}));
+    ASSERT_EQUAL(sheet->GetPrecedents("A1"_pos, true), Positions{});
+    ASSERT_EQUAL(sheet->GetDependents("A1"_pos, false), Positions{"B1"_pos});
+    ASSERT_EQUAL(sheet->GetDependents("A1"_pos, true), (Positions{"B1"_pos, "C1"_pos, "D1"_pos}));
+    // Пустые позиции тоже участвуют в зависимостях
+    ASSERT_EQUAL(sheet->GetDependents("A2"_pos, true), (Positions{"B1"_pos, "C1"_pos, "D1"_pos}));
+    ASSERT_EQUAL(sheet->GetDependents("Z100"_pos, true), Positions{"A3"_pos});
+    ASSERT_EQUAL(sheet->GetDependents("E5"_pos, true), Positions{});
+
+    ASSERT_EQUAL(sheet->GetDependents(Range{"A1"_pos, "A3"_pos}, false), (Positions{"B1"_pos}));
+    ASSERT_EQUAL(sheet->GetPrecedents(Range{"A1"_pos, "C3"_pos}, false),
+                 (Positions{"A1"_pos, "B1"_pos, "A2"_pos, "Z100"_pos}));
+    ASSERT_EQUAL(sheet->GetDependents(Range{"B1"_pos, "D1"_pos}, true), (Positions{"C1"_pos, "D1"_pos}));
+    // Область не больше числа пустых позиций с зависимостями
+    ASSERT_EQUAL(sheet->GetDependents(Range{"A1"_pos, "A2"_pos}, true), (Positions{"B1"_pos, "C1"_pos, "D1"_pos}));
+
+    sheet->SetCell("C1"_pos, "5");
+    ASSERT_EQUAL(sheet->GetPrecedents("D1"_pos, true), (Positions{"A1"_pos, "B1"_pos, "C1"_pos, "A2"_pos}));
+    ASSERT_EQUAL(sheet->GetDependents("A1"_pos, true), (Positions{"B1"_pos, "D1"_pos}));
+
+    try {
+        sheet->GetDependents(Range{"B2"_pos, "A1"_pos}, true);
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+}
+
+void TestRecalcStats() {
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell("A1"_pos, "1");
+    ASSERT_EQUAL(sheet->GetRecalcStats().changedCells.Get(), 0u);
+
+    sheet->EnableRecalcStats(true);
+    sheet->SetCell("B1"_pos, "=A1+1");
+    sheet->SetCell("C1"_pos, "=B1*2");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(4.0));
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(4.0));
+    RecalcStats stats = sheet->GetRecalcStats();
+    ASSERT_EQUAL(stats.parse.GetCount(), 2u);
+    ASSERT_EQUAL(stats.cycleCheck.GetCount(), 2u);
+    ASSERT_EQUAL(stats.invalidation.GetCount(), 2u);
+    ASSERT_EQUAL(stats.changedCells.Get(), 2u);
+    // Первое чтение C1 вычисляет B1 и C1, при этом B1 читается из кэша
+    ASSERT_EQUAL(stats.evaluations.Get(), 2u);
+    ASSERT_EQUAL(stats.evaluation.GetCount(), 2u);
+    ASSERT_EQUAL(stats.cacheMisses.Get(), 1u);
+    ASSERT_EQUAL(stats.cacheHits.Get(), 2u);
+    ASSERT(stats.evaluation.GetPercentile(0.5) <= stats.evaluation.GetPercentile(1.0));
+    ASSERT(stats.evaluation.GetTotal() <= stats.evaluation.GetPercentile(1.0) * 2);
+
+    sheet->ResetRecalcStats();
+    sheet->SetCell("A1"_pos, "1.0");
+    sheet->ClearCell("A1"_pos);
+    sheet->Recalculate();
+    stats = sheet->GetRecalcStats();
+    ASSERT_EQUAL(stats.parse.GetCount(), 0u);
+    ASSERT_EQUAL(stats.cacheResets.Get(), 1u);
+    ASSERT_EQUAL(stats.evaluations.Get(), 2u);
+
+    sheet->EnableRecalcStats(false);
+    sheet->SetCell("A1"_pos, "=2");
+    ASSERT_EQUAL(sheet->GetRecalcStats().parse.GetCount(), 0u);
+
+    LatencyHistogram histogram;
+    for (int i = 1; i <= 100; ++i) {
+        histogram.Add(std::chrono::nanoseconds(i * 10));
+    }
+    ASSERT_EQUAL(histogram.GetCount(), 100u);
+    ASSERT_EQUAL(histogram.GetTotal().count(), 50500);
+    ASSERT_EQUAL(histogram.GetPercentile(0.5).count(), 511);
+    ASSERT_EQUAL(histogram.GetPercentile(1.0).count(), 1023);
+}
+
+void TestRecalculateStep() {
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell("A1"_pos, "1");
+    for (int row = 0; row < 100; ++row) {
+        sheet->SetCell(Position{row, 1}, "=A1+" + std::to_string(row));
+    }
+    sheet->SetCell("D50"_pos, "=B50*2");
+    sheet->SetCell("E50"_pos, "=D50+1");
+    sheet->Recalculate();
+
+    sheet->EnableRecalcStats(true);
+    sheet->SetCell("A1"_pos, "2");
+    // Область E50 требует B50 и D50; остальное откладывается
+    const Range viewport{"D50"_pos, "E50"_pos};
+    ASSERT(!sheet->RecalculateStep(viewport, RecalcBudget{3}));
+    ASSERT_EQUAL(sheet->GetRecalcStats().evaluations.Get(), 3u);
+    ASSERT_EQUAL(sheet->GetCell("E50"_pos)->GetValue(), CellInterface::Value(103.0));
+    ASSERT_EQUAL(sheet->GetRecalcStats().cacheMisses.Get(), 0u);
+
+    int calls = 0;
+    while (!sheet->RecalculateStep(viewport, RecalcBudget{10})) {
+        ++calls;
+    }
+    ASSERT_EQUAL(calls, 9);
+    ASSERT_EQUAL(sheet->GetRecalcStats().evaluations.Get(), 102u);
+    ASSERT_EQUAL(sheet->GetCell("B100"_pos)->GetValue(), CellInterface::Value(101.0));
+    ASSERT_EQUAL(sheet->GetRecalcStats().cacheMisses.Get(), 0u);
+
+    // Изменение между шагами: уже вычисленные формулы пересчитываются,
+    // только если изменение их затронуло
+    sheet->ResetRecalcStats();
+    sheet->SetCell("A1"_pos, "3");
+    ASSERT(!sheet->RecalculateStep(viewport, RecalcBudget{1}));
+    sheet->SetCell("B1"_pos, "=A1*10");
+    const RecalcBudget timeBudget{0, std::chrono::milliseconds(100)};
+    while (!sheet->RecalculateStep(Range{"A1"_pos, "A1"_pos}, timeBudget)) {
+    }
+    // B50 вычислена до изменения B1 и только подтверждается
+    ASSERT_EQUAL(sheet->GetRecalcStats().evaluations.Get(), 102u);
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(30.0));
+    ASSERT_EQUAL(sheet->GetCell("E50"_pos)->GetValue(), CellInterface::Value(105.0));
+    ASSERT(sheet->RecalculateStep(viewport, RecalcBudget{1}));
+}
+
+void TestDeepFormula() {
+    // Правоассоциативная запись требует стека вычисления глубже
+    // встроенного буфера
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell("A1"_pos, "2");
+    std::string expression = "A1";
+    for (int i = 0; i < 50; ++i) {
+        expression = "1-(A1+" + expression + ")";
+    }
+    sheet->SetCell("B1"_pos, "=" + expression);
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetText(), "=" + expression);
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetReferencedCells(), std::vector<Position>{"A1"_pos});
+}
+
+void TestTextArguments() {
+    // Числовое значение текста вычисляется при записи и обновляется при
+    // каждом изменении текста
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell("A1"_pos, " 3");
+    sheet->SetCell("B1"_pos, "=A1*2");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(6.0));
+    sheet->SetCell("A1"_pos, "'3");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    sheet->SetCell("A1"_pos, "1e-400");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    sheet->SetCell("A1"_pos, "=1+1");
+    sheet->SetCell("A1"_pos, "2.5");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(5.0));
+    sheet->SetCells({{"A1"_pos, "meow"}});
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+}
+
+void TestSimplification() {
+    // Константы сворачиваются, а текст формулы остаётся прежним
+    ASSERT_EQUAL(ParseFormulaAST("2*3*A1+0").GetInstructionCount(), 5u);
+    ASSERT_EQUAL(ParseFormulaAST("--A1*1").GetInstructionCount(), 1u);
+    ASSERT_EQUAL(ParseFormulaAST("B1-(-A1)").GetInstructionCount(), 3u);
+    ASSERT_EQUAL(ParseFormulaAST("A1/0").GetInstructionCount(), 3u);
+
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell("A1"_pos, "=0*-1");
+    sheet->SetCell("B1"_pos, "=2*3*(A1+4)+0");
+    sheet->SetCell("C1"_pos, "=A1+0");
+    sheet->SetCell("D1"_pos, "=A1-0");
+    sheet->SetCell("E1"_pos, "=1/(2-2)");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetText(), "=2*3*(A1+4)+0");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(24.0));
+    // Сложение с нулём превращает -0 в +0, поэтому не удаляется
+    ASSERT(std::signbit(std::get<double>(sheet->GetCell("A1"_pos)->GetValue())));
+    ASSERT(!std::signbit(std::get<double>(sheet->GetCell("C1"_pos)->GetValue())));
+    ASSERT(std::signbit(std::get<double>(sheet->GetCell("D1"_pos)->GetValue())));
+    // Деление на константный ноль остаётся ошибкой вычисления
+    ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+}
+
+void TestSharedFormulas() {
+    // Формулы, заполненные вниз, разбираются один раз
+    auto sheet = std::make_unique<Sheet>();
+    for (int row = 0; row < 100; ++row) {
+        const std::string number = std::to_string(row + 1);
+        sheet->SetCell(Position{row, 0}, std::to_string(row));
+        sheet->SetCell(Position{row, 1}, "2");
+        sheet->SetCell(Position{row, 2}, "=A" + number + "*B" + number);
+    }
+    ASSERT_EQUAL(sheet->GetFormulaPool().Size(), 1u);
+    ASSERT_EQUAL(sheet->GetCell("C43"_pos)->GetText(), "=A43*B43");
+    ASSERT_EQUAL(sheet->GetCell("C43"_pos)->GetValue(), CellInterface::Value(84.0));
+    ASSERT_EQUAL(sheet->GetCell("C43"_pos)->GetReferencedCells(),
+                 (std::vector<Position>{"A43"_pos, "B43"_pos}));
+
+    // Тот же текст в другой строке - другие относительные ссылки
+    sheet->SetCell("D1"_pos, "=A43*B43");
+    ASSERT_EQUAL(sheet->GetFormulaPool().Size(), 2u);
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(84.0));
+
+    // Порядок числа не принимается за ссылку
+    sheet->SetCell("E1"_pos, "=1E5+A1");
+    sheet->SetCell("E2"_pos, "=1E6+A2");
+    ASSERT_EQUAL(sheet->GetFormulaPool().Size(), 4u);
+    ASSERT_EQUAL(sheet->GetCell("E2"_pos)->GetValue(), CellInterface::Value(1e6 + 1));
+    ASSERT_EQUAL(sheet->GetCell("E2"_pos)->GetText(), "=1e+06+A2");
+
+    // Пакетная загрузка использует тот же пул
+    sheet->SetCells({{"F1"_pos, "=C1+1"}, {"F2"_pos, "=C2+1"}, {"F3"_pos, "=C3+1"}});
+    ASSERT_EQUAL(sheet->GetFormulaPool().Size(), 5u);
+    ASSERT_EQUAL(sheet->GetCell("F3"_pos)->GetValue(), CellInterface::Value(5.0));
+
+    for (int row = 0; row < 100; ++row) {
+        for (int col = 2; col < 6; ++col) {
+            sheet->ClearCell(Position{row, col});
+        }
+    }
+    ASSERT_EQUAL(sheet->GetFormulaPool().Size(), 0u);
+    ASSERT_EQUAL(sheet->GetMemoryStats().formulas, 0u);
+}
+
 }  // namespace
 
 int main() {
@@ -221,8 +1174,32 @@ int main() {
     RUN_TEST(tr, TestInvalidPosition);
     RUN_TEST(tr, TestSetCellPlainText);
     RUN_TEST(tr, TestClearCell);
+    RUN_TEST(tr, TestCellsAcrossTiles);
+    RUN_TEST(tr, TestSpareTiles);
     RUN_TEST(tr, TestPrint);
+    RUN_TEST(tr, TestPrintSparse);
+    RUN_TEST(tr, TestPrintableSizeAfterClear);
     RUN_TEST(tr, TestExpressions);
     RUN_TEST(tr, TestErrors);
+    RUN_TEST(tr, TestUpdateInPlace);
+    RUN_TEST(tr, TestSharedTexts);
+    RUN_TEST(tr, TestMemoryStats);
+    RUN_TEST(tr, TestReferencedEmptyCells);
+    RUN_TEST(tr, TestSetCells);
+    RUN_TEST(tr, TestRecalculate);
+    RUN_TEST(tr, TestLongChain);
+    RUN_TEST(tr, TestParallelRecalculate);
+    RUN_TEST(tr, TestTopologicalOrder);
+    RUN_TEST(tr, TestRevisions);
+    RUN_TEST(tr, TestRepeatedCreateAndErase);
+    RUN_TEST(tr, TestEarlyCutoff);
+    RUN_TEST(tr, TestDependencyGraph);
+    RUN_TEST(tr, TestPrecedentsAndDependents);
+    RUN_TEST(tr, TestRecalcStats);
+    RUN_TEST(tr, TestRecalculateStep);
+    RUN_TEST(tr, TestDeepFormula);
+    RUN_TEST(tr, TestTextArguments);
+    RUN_TEST(tr, TestSimplification);
+    RUN_TEST(tr, TestSharedFormulas);
     return 0;
 }
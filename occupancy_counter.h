@@ -0,0 +1,63 @@
+#pragma once
+
+#include "bit_utils.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Счётчик занятых позиций вдоль одного измерения таблицы (строк или столбцов).
+// Хранит количество ячеек для каждого индекса и битовую маску непустых
+// индексов, по которой граница занятой области пересчитывается не более чем
+// за SIZE / 64 шагов даже после удаления последней ячейки.
+template <int SIZE>
+class OccupancyCounter {
+public:
+    void Add(int index) {
+        if (static_cast<size_t>(index) >= counts_.size()) {
+            counts_.resize(index + 1, 0);
+        }
+        if (counts_[index]++ == 0) {
+            nonEmpty_[index / WORD_BITS] |= uint64_t{1} << (index % WORD_BITS);
+            if (index >= extent_) {
+                extent_ = index + 1;
+            }
+        }
+    }
+
+    void Remove(int index) {
+        if (--counts_[index] != 0) {
+            return;
+        }
+        nonEmpty_[index / WORD_BITS] &= ~(uint64_t{1} << (index % WORD_BITS));
+        if (index + 1 == extent_) {
+            extent_ = FindExtent(index / WORD_BITS);
+        }
+    }
+
+    // Индекс, следующий за последним занятым
+    int Extent() const {
+        return extent_;
+    }
+
+    size_t GetMemoryUsage() const {
+        return counts_.capacity() * sizeof(counts_[0]) + sizeof(*this);
+    }
+
+private:
+    static const int WORD_BITS = 64;
+    static_assert(SIZE % WORD_BITS == 0, "size must be a multiple of the word size");
+
+    int FindExtent(int fromWord) const {
+        for (int word = fromWord; word >= 0; --word) {
+            if (uint64_t bits = nonEmpty_[word]; bits != 0) {
+                return word * WORD_BITS + HighestBit(bits) + 1;
+            }
+        }
+        return 0;
+    }
+
+    std::vector<uint32_t> counts_;
+    std::array<uint64_t, SIZE / WORD_BITS> nonEmpty_ = {};
+    int extent_ = 0;
+};
@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <string>
 #include <sstream>
+#include <tuple>
 
 
 const int LETTERS = 26;
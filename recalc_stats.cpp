@@ -0,0 +1,37 @@
+#include "recalc_stats.h"
+
+#include "bit_utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+void LatencyHistogram::Add(Duration duration) {
+    const uint64_t nanoseconds = std::max<int64_t>(duration.count(), 0);
+    const int bucket = nanoseconds == 0 ? 0 : std::min(HighestBit(nanoseconds), BUCKET_COUNT - 1);
+    buckets_[bucket].Add();
+    count_.Add();
+    total_.Add(nanoseconds);
+}
+
+LatencyHistogram::Duration LatencyHistogram::GetPercentile(double fraction) const {
+    uint64_t counts[BUCKET_COUNT];
+    uint64_t count = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        counts[i] = buckets_[i].Get();
+        count += counts[i];
+    }
+    if (count == 0) {
+        return Duration(0);
+    }
+    // Номер длительности квантиля в упорядоченном ряду, начиная с единицы
+    const uint64_t rank = std::max<uint64_t>(
+            static_cast<uint64_t>(std::ceil(std::clamp(fraction, 0.0, 1.0) * count)), 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return Duration((uint64_t{1} << (i + 1)) - 1);
+        }
+    }
+    return Duration((uint64_t{1} << BUCKET_COUNT) - 1);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Счётчик статистики. Увеличивается из всех потоков пересчёта без
+// упорядочивания операций; копирование читает текущее значение.
+class StatCounter {
+public:
+    StatCounter() = default;
+
+    StatCounter(const StatCounter& other)
+        : value_(other.Get()) {
+    }
+
+    StatCounter& operator=(const StatCounter& other) {
+        value_.store(other.Get(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void Add(uint64_t count = 1) {
+        value_.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    uint64_t Get() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+// Гистограмма длительностей с корзинами по степеням двойки: корзина i
+// содержит длительности из [2^i, 2^(i+1)) наносекунд, нулевая - также
+// нулевые, последняя - все длительности от 2^(BUCKET_COUNT-1).
+class LatencyHistogram {
+public:
+    using Duration = std::chrono::nanoseconds;
+
+    static const int BUCKET_COUNT = 40;
+
+    void Add(Duration duration);
+
+    uint64_t GetCount() const {
+        return count_.Get();
+    }
+
+    Duration GetTotal() const {
+        return Duration(total_.Get());
+    }
+
+    uint64_t GetBucketCount(int bucket) const {
+        return buckets_[bucket].Get();
+    }
+
+    // Оценка квантиля fraction из [0, 1]: верхняя граница корзины, в
+    // которую попадает квантиль. Для пустой гистограммы - ноль.
+    Duration GetPercentile(double fraction) const;
+
+private:
+    StatCounter buckets_[BUCKET_COUNT];
+    StatCounter count_;
+    // Сумма длительностей в наносекундах
+    StatCounter total_;
+};
+
+// Статистика работы таблицы с момента включения или последнего сброса
+struct RecalcStats {
+    // Чтения значения формулы, обслуженные кэшем без проверок
+    StatCounter cacheHits;
+    // Чтения, потребовавшие проверки или вычисления формулы
+    StatCounter cacheMisses;
+    // Вычисления формул
+    StatCounter evaluations;
+    // Кэши формул, подтверждённые без вычисления, так как не изменилась
+    // ни одна ячейка, на которую ссылается формула
+    StatCounter verifications;
+    // Ячейки, помеченные изменёнными
+    StatCounter changedCells;
+    // Кэши формул, сброшенные явно при удалении ячеек, на которые они
+    // ссылаются
+    StatCounter cacheResets;
+
+    // Разбор текста формулы
+    LatencyHistogram parse;
+    // Поиск циклов и обновление топологического порядка
+    LatencyHistogram cycleCheck;
+    // Регистрация изменения: обновление графа зависимостей, отметки об
+    // изменении и сброс кэшей
+    LatencyHistogram invalidation;
+    // Вычисление одной формулы
+    LatencyHistogram evaluation;
+};
+
+// Добавляет в гистограмму время жизни объекта. Если гистограмма не задана,
+// время не измеряется.
+class ScopedLatency {
+public:
+    explicit ScopedLatency(LatencyHistogram* histogram)
+        : histogram_(histogram) {
+        if (histogram_) {
+            start_ = Clock::now();
+        }
+    }
+
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+    ~ScopedLatency() {
+        if (histogram_) {
+            histogram_->Add(Clock::now() - start_);
+        }
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    LatencyHistogram* histogram_;
+    Clock::time_point start_;
+};
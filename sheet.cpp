@@ -3,124 +3,1029 @@
 #include "cell.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <optional>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std::literals;
 
+namespace {
+
+// Ищет ячейки, входящие в циклы графа зависимостей, достижимые из roots.
+// getReferences(pos) возвращает ячейки, от которых зависит pos. Используется
+// итеративный алгоритм Тарьяна: в цикле лежат вершины сильно связных
+// компонент из нескольких вершин и вершины с петлёй.
+template <typename ReferencesGetter>
+std::vector<Position> FindCyclicCells(const std::vector<Position>& roots,
+                                      ReferencesGetter getReferences) {
+    struct NodeState {
+        int index;
+        int lowLink;
+        bool onStack;
+    };
+    struct Frame {
+        Position pos;
+        std::vector<Position> references;
+        size_t next = 0;
+    };
+
+    std::unordered_map<Position, NodeState, PositionHasher> states;
+    std::vector<Position> sccStack;
+    std::vector<Frame> callStack;
+    std::vector<Position> result;
+    int nextIndex = 0;
+
+    auto enter = [&](Position pos) {
+        states[pos] = {nextIndex, nextIndex, true};
+        ++nextIndex;
+        sccStack.push_back(pos);
+        callStack.push_back({pos, getReferences(pos)});
+    };
+
+    for (Position root : roots) {
+        if (states.count(root) != 0) {
+            continue;
+        }
+        enter(root);
+        while (!callStack.empty()) {
+            Frame& frame = callStack.back();
+            if (frame.next < frame.references.size()) {
+                const Position next = frame.references[frame.next++];
+                if (auto it = states.find(next); it == states.end()) {
+                    enter(next);
+                } else if (it->second.onStack) {
+                    NodeState& state = states[frame.pos];
+                    state.lowLink = std::min(state.lowLink, it->second.index);
+                }
+                continue;
+            }
+
+            const Position pos = frame.pos;
+            const bool hasSelfLoop = std::find(frame.references.begin(), frame.references.end(), pos)
+                    != frame.references.end();
+            callStack.pop_back();
+            const NodeState state = states[pos];
+            if (!callStack.empty()) {
+                NodeState& parent = states[callStack.back().pos];
+                parent.lowLink = std::min(parent.lowLink, state.lowLink);
+            }
+            if (state.lowLink != state.index) {
+                continue;
+            }
+
+            // pos - корень сильно связной компоненты
+            auto componentBegin = std::find(sccStack.rbegin(), sccStack.rend(), pos).base() - 1;
+            if (sccStack.end() - componentBegin > 1 || hasSelfLoop) {
+                result.insert(result.end(), componentBegin, sccStack.end());
+            }
+            for (auto it = componentBegin; it != sccStack.end(); ++it) {
+                states[*it].onStack = false;
+            }
+            sccStack.erase(componentBegin, sccStack.end());
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+// Бросает InvalidPositionException, если границы области недопустимы или
+// перепутаны
+void CheckRange(Range range) {
+    if (!range.topLeft.IsValid() || !range.bottomRight.IsValid()
+            || range.bottomRight.row < range.topLeft.row || range.bottomRight.col < range.topLeft.col) {
+        throw InvalidPositionException("Invalid range"s);
+    }
+}
+
+}  // namespace
+
 Sheet::~Sheet() {}
 
 void Sheet::SetCell(Position pos, std::string text) {
     if (!pos.IsValid()) {
         throw InvalidPositionException("Invalid cell position"s);
     }
-    if (pos.col >= printableSize_.cols || pos.row >= printableSize_.rows) {
-        Resize({pos.row >= printableSize_.rows ? pos.row+1 : printableSize_.rows,
-                pos.col >= printableSize_.cols ? pos.col+1 : printableSize_.cols});
+    // Существующая ячейка обновляется на месте, сохраняя зависимости вверх
+    if (Cell* cell = cells_.Get(pos); cell) {
+        cell->Set(std::move(text));
+        return;
+    }
+
+    Cell& cell = CreateCell(pos);
+    try {
+        cell.Set(std::move(text));
+    } catch (...) {
+        // Некорректная формула не должна оставлять после себя пустую ячейку
+        EraseCell(pos);
+        throw;
+    }
+}
+
+void Sheet::SetCells(const std::vector<std::pair<Position, std::string>>& cells) {
+    // Последнее значение для каждой позиции
+    std::unordered_map<Position, size_t, PositionHasher> lastEntry;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        if (!cells[i].first.IsValid()) {
+            throw InvalidPositionException("Invalid cell position"s);
+        }
+        lastEntry[cells[i].first] = i;
+    }
+
+    struct Entry {
+        Position pos;
+        const std::string* text;
+        std::unique_ptr<FormulaInterface> formula;
+        std::vector<Position> references;
+    };
+    std::vector<Entry> entries;
+    entries.reserve(lastEntry.size());
+    for (size_t i = 0; i < cells.size(); ++i) {
+        const auto& [pos, text] = cells[i];
+        if (lastEntry.at(pos) != i) {
+            continue;
+        }
+        Entry entry{pos, &text, nullptr, {}};
+        if (Cell::IsFormulaText(text)) {
+            try {
+                ScopedLatency timer(stats_ ? &stats_->parse : nullptr);
+                entry.formula = ParseFormula(std::string_view(text).substr(1), pos, formulaPool_);
+            }  catch (...) {
+                throw FormulaException("Formula syntax error in "s + pos.ToString());
+            }
+            entry.references = entry.formula->GetReferencedCells();
+        }
+        entries.push_back(std::move(entry));
+    }
+
+    // Новые циклы обязательно проходят через ячейки пакета, поэтому граф
+    // обходится только от них
+    std::unordered_map<Position, const Entry*, PositionHasher> entryByPos;
+    std::vector<Position> roots;
+    roots.reserve(entries.size());
+    for (const Entry& entry : entries) {
+        entryByPos[entry.pos] = &entry;
+        roots.push_back(entry.pos);
+    }
+    std::vector<Position> cyclicCells;
+    {
+        ScopedLatency timer(stats_ ? &stats_->cycleCheck : nullptr);
+        cyclicCells = FindCyclicCells(roots, [&](Position pos) {
+            if (auto it = entryByPos.find(pos); it != entryByPos.end()) {
+                return it->second->references;
+            }
+            if (const Cell* cell = cells_.Get(pos); cell) {
+                return cell->GetReferencedCells();
+            }
+            return std::vector<Position>{};
+        });
     }
-    cells_[pos] = std::make_unique<Cell>(*this, pos);
-    cells_[pos]->Set(text);
+    if (!cyclicCells.empty()) {
+        std::ostringstream message;
+        message << "Circular dependency found:";
+        for (Position pos : cyclicCells) {
+            message << ' ' << pos.ToString();
+        }
+        throw CircularDependencyException(message.str());
+    }
+
+    // Сначала создаются все ячейки пакета, затем регистрируются зависимости,
+    // чтобы ссылки между ячейками пакета не создавали заглушек. Весь пакет
+    // учитывается в статистике как одна регистрация изменения.
+    ScopedLatency timer(stats_ ? &stats_->invalidation : nullptr);
+    NewRevision();
+    for (Entry& entry : entries) {
+        Cell* cell = cells_.Get(entry.pos);
+        if (!cell) {
+            cell = &CreateCell(entry.pos);
+        }
+        cell->SetUnchecked(*entry.text, std::move(entry.formula));
+    }
+    std::vector<Cell*> updated;
+    updated.reserve(entries.size());
+    for (const Entry& entry : entries) {
+        Cell* cell = cells_.Get(entry.pos);
+        cell->Register();
+        updated.push_back(cell);
+    }
+    // Циклов в пакете нет. Ссылки ячеек пакета могут нарушать порядок
+    // сразу в нескольких местах, поэтому вместо поочерёдного восстановления
+    // порядка для каждой ссылки пакет и зависящие от него ячейки
+    // нумеруются заново одним проходом.
+    OrderLast(updated);
 }
 
 const CellInterface* Sheet::GetCell(Position pos) const {
     if (!pos.IsValid()) {
         throw InvalidPositionException("Invalid cell position"s);
     }
-    if (pos.col < printableSize_.cols && pos.row < printableSize_.rows) {
-        return cells_.at(pos).get();
-    } else {
-        return nullptr;
-    }
+    return cells_.Get(pos);
 }
 
 CellInterface* Sheet::GetCell(Position pos) {
     if (!pos.IsValid()) {
         throw InvalidPositionException("Invalid cell position"s);
     }
-    if (pos.col < printableSize_.cols && pos.row < printableSize_.rows) {
-        return cells_[pos].get();
-    } else {
-        return nullptr;
-    }
+    return cells_.Get(pos);
 }
 
 void Sheet::ClearCell(Position pos) {
     if (!pos.IsValid()) {
         throw InvalidPositionException("Invalid cell position"s);
     }
-    if (const auto* cellPointer = GetCell(pos); cellPointer) {
-        cells_[pos]->Clear();
-        delete cells_[pos].release();
-        Squeeze();
+    if (Cell* cell = cells_.Get(pos); cell) {
+        cell->Clear();
+        EraseCell(pos);
     }
 }
 
-Size Sheet::GetPrintableSize() const {
-    return printableSize_;
+void Sheet::AddDependent(Position pos, Position dependent) {
+    const DependencyGraph::NodeId node = GetOrCreateNode(pos);
+    graph_.AddEdge(node, GetOrCreateNode(dependent));
 }
 
-void Sheet::PrintValues(std::ostream& output) const {
-    for (int i = 0; i < printableSize_.rows; ++i) {
-        bool isFirstCell = true;
-        for (int j = 0; j < printableSize_.cols; ++j) {
-            if (!isFirstCell) {
-                output << '\t';
+void Sheet::RemoveDependent(Position pos, Position dependent) {
+    const DependencyGraph::NodeId node = FindNode(pos);
+    const DependencyGraph::NodeId dependentNode = FindNode(dependent);
+    if (node == DependencyGraph::NO_NODE || dependentNode == DependencyGraph::NO_NODE) {
+        return;
+    }
+    graph_.RemoveEdge(node, dependentNode);
+    if (graph_.GetDependentCount(node) == 0) {
+        if (auto it = placeholders_.find(pos); it != placeholders_.end()) {
+            graph_.RemoveNode(node);
+            placeholders_.erase(it);
+        }
+    }
+}
+
+DependencyGraph::NodeId Sheet::FindNode(Position pos) const {
+    if (const Cell* cell = cells_.Get(pos); cell) {
+        return cell->GetNodeId();
+    }
+    auto it = placeholders_.find(pos);
+    return it != placeholders_.end() ? it->second : DependencyGraph::NO_NODE;
+}
+
+DependencyGraph::NodeId Sheet::GetOrCreateNode(Position pos) {
+    if (Cell* cell = cells_.Get(pos); cell) {
+        if (cell->GetNodeId() == DependencyGraph::NO_NODE) {
+            cell->SetNodeId(graph_.AddNode(pos));
+        }
+        return cell->GetNodeId();
+    }
+    if (auto it = placeholders_.find(pos); it != placeholders_.end()) {
+        return it->second;
+    }
+    const DependencyGraph::NodeId node = graph_.AddNode(pos);
+    placeholders_.emplace(pos, node);
+    return node;
+}
+
+template <typename Visitor>
+void Sheet::ForEachDependent(DependencyGraph::NodeId node, Visitor&& visitor) const {
+    if (node == DependencyGraph::NO_NODE) {
+        return;
+    }
+    graph_.ForEachDependent(node, [this, &visitor](DependencyGraph::NodeId dependent) {
+        visitor(graph_.GetPosition(dependent));
+    });
+}
+
+bool Sheet::UpdateOrder(Position pos, const std::vector<Position>& references) {
+    Cell* cell = cells_.Get(pos);
+    for (const Position reference : references) {
+        if (reference == pos) {
+            return false;
+        }
+        // Пустые позиции ни от чего не зависят и в порядке не участвуют
+        Cell* referencedCell = cells_.Get(reference);
+        if (referencedCell && referencedCell->GetOrder() > cell->GetOrder()
+                && !Reorder(*referencedCell, *cell)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Sheet::Reorder(Cell& from, Cell& to) {
+    const int lower = to.GetOrder();
+    const int upper = from.GetOrder();
+
+    // Ячейки, зависящие от to, с номерами меньше upper. Если среди них
+    // есть from, ссылка замыкает цикл.
+    std::vector<Cell*> forward{&to};
+    std::unordered_set<Position, PositionHasher> visited{to.GetPosition()};
+    bool hasCycle = false;
+    for (size_t i = 0; i < forward.size() && !hasCycle; ++i) {
+        ForEachDependent(forward[i]->GetNodeId(), [&](Position dependent) {
+            if (hasCycle || !visited.insert(dependent).second) {
+                return;
             }
-            if (cells_.count({i,j}) != 0) {
-                PrintCellValue(cells_.at({i,j}).get(), output);
+            Cell* cell = cells_.Get(dependent);
+            if (cell == &from) {
+                hasCycle = true;
+            } else if (cell->GetOrder() < upper) {
+                forward.push_back(cell);
+            }
+        });
+    }
+    if (hasCycle) {
+        return false;
+    }
+
+    // Ячейки, от которых зависит from, с номерами между lower и upper
+    std::vector<Cell*> backward{&from};
+    for (size_t i = 0; i < backward.size(); ++i) {
+        for (const Position reference : backward[i]->GetReferencedCells()) {
+            Cell* cell = cells_.Get(reference);
+            if (cell && cell->GetOrder() > lower && cell->GetOrder() < upper
+                    && visited.insert(reference).second) {
+                backward.push_back(cell);
             }
-            isFirstCell = false;
         }
-        output << '\n';
     }
+
+    // Обе группы занимают прежний набор номеров: сначала backward, затем
+    // forward, с сохранением порядка внутри групп
+    auto byOrder = [](const Cell* lhs, const Cell* rhs) {
+        return lhs->GetOrder() < rhs->GetOrder();
+    };
+    std::sort(forward.begin(), forward.end(), byOrder);
+    std::sort(backward.begin(), backward.end(), byOrder);
+    std::vector<int> orders;
+    orders.reserve(forward.size() + backward.size());
+    for (const Cell* cell : backward) {
+        orders.push_back(cell->GetOrder());
+    }
+    for (const Cell* cell : forward) {
+        orders.push_back(cell->GetOrder());
+    }
+    std::sort(orders.begin(), orders.end());
+    size_t next = 0;
+    for (Cell* cell : backward) {
+        cell->SetOrder(orders[next++]);
+    }
+    for (Cell* cell : forward) {
+        cell->SetOrder(orders[next++]);
+    }
+    return true;
 }
 
-void Sheet::PrintTexts(std::ostream& output) const {
-     for (int i = 0; i < printableSize_.rows; ++i) {
-        bool isFirstCell = true;
-        for (int j = 0; j < printableSize_.cols; ++j) {
-            if (!isFirstCell) {
-                output << '\t';
+void Sheet::OrderLast(const std::vector<Cell*>& roots) {
+    // Ячейки roots и все зависящие от них; индексы - в affected
+    std::vector<Cell*> affected;
+    std::unordered_map<Position, size_t, PositionHasher> indexByPos;
+    auto add = [&](Position pos) {
+        if (indexByPos.emplace(pos, affected.size()).second) {
+            affected.push_back(cells_.Get(pos));
+        }
+    };
+    for (const Cell* cell : roots) {
+        add(cell->GetPosition());
+    }
+    for (size_t i = 0; i < affected.size(); ++i) {
+        ForEachDependent(affected[i]->GetNodeId(), add);
+    }
+
+    // Число ссылок каждой ячейки на ячейки affected: зависимые ячейки
+    // affected тоже лежат в affected
+    std::vector<size_t> referenceCounts(affected.size(), 0);
+    for (const Cell* cell : affected) {
+        ForEachDependent(cell->GetNodeId(), [&](Position dependent) {
+            ++referenceCounts[indexByPos.at(dependent)];
+        });
+    }
+
+    if (maxOrder_ > std::numeric_limits<int>::max() - static_cast<int>(affected.size())) {
+        RenumberOrder();
+    }
+    // Алгоритм Кана: номер получает ячейка, все ссылки которой на ячейки
+    // affected уже пронумерованы. Ссылки на остальные ячейки ведут к
+    // меньшим номерам, так как все новые номера больше прежних.
+    std::vector<Cell*> ready;
+    for (size_t i = 0; i < affected.size(); ++i) {
+        if (referenceCounts[i] == 0) {
+            ready.push_back(affected[i]);
+        }
+    }
+    size_t ordered = 0;
+    while (!ready.empty()) {
+        Cell* cell = ready.back();
+        ready.pop_back();
+        cell->SetOrder(++maxOrder_);
+        ++ordered;
+        ForEachDependent(cell->GetNodeId(), [&](Position dependent) {
+            const size_t index = indexByPos.at(dependent);
+            if (--referenceCounts[index] == 0) {
+                ready.push_back(affected[index]);
             }
-            if (cells_.count({i,j}) != 0) {
-                output<<cells_.at({i,j})->GetText();
+        });
+    }
+    assert(ordered == affected.size());
+}
+
+void Sheet::RenumberOrder() {
+    std::vector<Cell*> cells;
+    cells.reserve(cells_.Size());
+    cells_.ForEach([&cells](Position, Cell& cell) {
+        cells.push_back(&cell);
+    });
+    std::sort(cells.begin(), cells.end(), [](const Cell* lhs, const Cell* rhs) {
+        return lhs->GetOrder() < rhs->GetOrder();
+    });
+    // Номера располагаются вокруг нуля, оставляя запас в обе стороны
+    minOrder_ = -static_cast<int>(cells.size() / 2);
+    maxOrder_ = minOrder_ - 1;
+    for (Cell* cell : cells) {
+        cell->SetOrder(++maxOrder_);
+    }
+}
+
+uint32_t Sheet::NewRevision() {
+    if (revision_ == std::numeric_limits<uint32_t>::max()) {
+        ResetRevisions();
+    }
+    return ++revision_;
+}
+
+void Sheet::AddChangedCell(Position pos) {
+    changedCells_.push_back(pos);
+}
+
+void Sheet::BringUpToDate(const Cell& cell) {
+    struct Frame {
+        const Cell* cell;
+        std::vector<Position> references;
+        size_t next = 0;
+    };
+    std::vector<Frame> stack;
+    stack.push_back({&cell, cell.GetReferencedCells()});
+    while (!stack.empty()) {
+        Frame& frame = stack.back();
+        if (frame.next < frame.references.size()) {
+            const Cell* referenced = cells_.Get(frame.references[frame.next++]);
+            if (referenced && !referenced->IsUpToDate()) {
+                stack.push_back({referenced, referenced->GetReferencedCells()});
             }
-            isFirstCell = false;
+            continue;
         }
-        output << '\n';
+
+        // Все ячейки, на которые ссылается формула, актуальны
+        const Cell* current = frame.cell;
+        if (!current->HasCache() || HasChangedReferences(*current, frame.references)) {
+            current->Evaluate();
+        } else {
+            current->MarkVerified();
+        }
+        stack.pop_back();
     }
 }
 
-void Sheet::Resize(Size newSize) {
-    printableSize_ = newSize;
-}
+void Sheet::Recalculate() {
+    // Формулы обрабатываются частями такого размера, чтобы накладные
+    // расходы на распределение работы между потоками были малы
+    static const size_t CHUNK_SIZE = 64;
 
-void Sheet::Squeeze() {
-    Size newPrintableSize = {0, 0};
-    for (int i = 0; i < printableSize_.rows; ++i) {
-        for (int j = 0; j < printableSize_.cols; ++j) {
-            if (cells_[{i,j}]) {
-                if (i >= newPrintableSize.rows) {
-                    newPrintableSize.rows = i+1;
+    if (recalculating_) {
+        return;
+    }
+    if (changedCells_.empty()) {
+        recalculatedAt_ = revision_;
+        return;
+    }
+    recalculating_ = true;
+
+    std::unordered_map<Position, size_t, PositionHasher> indexByPos;
+    const std::vector<const Cell*> toEvaluate = CollectAffectedFormulas(indexByPos);
+
+    // Для каждой затронутой формулы - число ещё не вычисленных затронутых
+    // формул, от которых она зависит
+    std::vector<std::atomic<int>> pendingReferences(toEvaluate.size());
+    std::vector<const Cell*> level;
+    for (size_t i = 0; i < toEvaluate.size(); ++i) {
+        int pending = 0;
+        for (const Position pos : toEvaluate[i]->GetReferencedCells()) {
+            pending += indexByPos.count(pos);
+        }
+        pendingReferences[i] = pending;
+        if (pending == 0) {
+            level.push_back(toEvaluate[i]);
+        }
+    }
+
+    // Незатронутые ячейки актуальны, а затронутые читаются только после
+    // своего вычисления, поэтому на время пересчёта все кэши считаются
+    // проверенными и чтение значений не запускает проверку
+    const uint32_t previousRecalculation = recalculatedAt_;
+    recalculatedAt_ = revision_;
+
+    // Алгоритм Кана по уровням: формулы уровня зависят только от формул
+    // предыдущих уровней и вычисляются в любом порядке. Формула попадает в
+    // следующий уровень, когда вычислены все затронутые формулы, от которых
+    // она зависит.
+    std::vector<const Cell*> nextLevel;
+    std::mutex nextLevelMutex;
+    const WorkerPool::Task evaluateRange = [&](size_t begin, size_t end) {
+        std::vector<const Cell*> ready;
+        for (size_t i = begin; i < end; ++i) {
+            const Cell* cell = level[i];
+            RecalculateCell(*cell);
+            ForEachDependent(cell->GetNodeId(), [&](Position dependent) {
+                if (auto it = indexByPos.find(dependent); it != indexByPos.end()
+                        && pendingReferences[it->second].fetch_sub(1) == 1) {
+                    ready.push_back(toEvaluate[it->second]);
                 }
-                if (j >= newPrintableSize.cols) {
-                    newPrintableSize.cols = j+1;
+            });
+        }
+        std::lock_guard lock(nextLevelMutex);
+        nextLevel.insert(nextLevel.end(), ready.begin(), ready.end());
+    };
+    try {
+        while (!level.empty()) {
+            if (workerPool_) {
+                workerPool_->ParallelFor(level.size(), CHUNK_SIZE, evaluateRange);
+            } else {
+                evaluateRange(0, level.size());
+            }
+            level.swap(nextLevel);
+            nextLevel.clear();
+        }
+    } catch (...) {
+        // Изменения остаются в списке до следующего пересчёта
+        recalculatedAt_ = previousRecalculation;
+        recalculating_ = false;
+        throw;
+    }
+
+    FinishRecalculation();
+    recalculating_ = false;
+}
+
+bool Sheet::RecalculateStep(Range priority, RecalcBudget budget) {
+    CheckRange(priority);
+    if (recalculating_) {
+        return false;
+    }
+    if (changedCells_.empty()) {
+        recalculatedAt_ = revision_;
+        return true;
+    }
+    recalculating_ = true;
+
+    // Очередь строится заново после каждого изменения таблицы: формулы,
+    // обработанные до изменения, будут лишь подтверждены, если изменение
+    // их не затронуло
+    if (stepQueue_.empty() || stepQueueRevision_ != revision_) {
+        std::unordered_map<Position, size_t, PositionHasher> indexByPos;
+        std::vector<const Cell*> affected = CollectAffectedFormulas(indexByPos);
+        std::sort(affected.begin(), affected.end(), [](const Cell* lhs, const Cell* rhs) {
+            return lhs->GetOrder() < rhs->GetOrder();
+        });
+        stepQueue_.clear();
+        stepQueueIndex_.clear();
+        for (const Cell* cell : affected) {
+            stepQueueIndex_.emplace(cell->GetPosition(), stepQueue_.size());
+            stepQueue_.push_back(cell->GetPosition());
+        }
+        stepQueueNext_ = 0;
+        stepQueueRevision_ = revision_;
+    }
+
+    // Затронутые формулы области и затронутые формулы, от которых они
+    // транзитивно зависят, в топологическом порядке
+    std::vector<size_t> priorityIndices;
+    std::unordered_set<size_t> seen;
+    cells_.ForEachInRange(priority.topLeft, priority.bottomRight, [&](Position pos, const Cell&) {
+        if (auto it = stepQueueIndex_.find(pos); it != stepQueueIndex_.end() && seen.insert(it->second).second) {
+            priorityIndices.push_back(it->second);
+        }
+    });
+    for (size_t i = 0; i < priorityIndices.size(); ++i) {
+        const Cell* cell = cells_.Get(stepQueue_[priorityIndices[i]]);
+        if (cell->GetVerifiedAt() == revision_ && cell->HasCache()) {
+            continue;
+        }
+        for (const Position reference : cell->GetReferencedCells()) {
+            if (auto it = stepQueueIndex_.find(reference); it != stepQueueIndex_.end() && seen.insert(it->second).second) {
+                priorityIndices.push_back(it->second);
+            }
+        }
+    }
+    std::sort(priorityIndices.begin(), priorityIndices.end());
+
+    // Формулы обрабатываются в топологическом порядке, поэтому ячейки, на
+    // которые они ссылаются, уже актуальны, и чтение их значений не требует
+    // проверок
+    const uint32_t previousRecalculation = recalculatedAt_;
+    recalculatedAt_ = revision_;
+    const auto start = std::chrono::steady_clock::now();
+    size_t steps = 0;
+    // Хотя бы одна формула обрабатывается при любом бюджете
+    auto budgetExhausted = [&]() {
+        return (budget.maxFormulas != 0 && steps >= budget.maxFormulas)
+                || (budget.maxDuration.count() != 0 && steps != 0
+                    && std::chrono::steady_clock::now() - start >= budget.maxDuration);
+    };
+    auto process = [&](size_t index) {
+        const Cell* cell = cells_.Get(stepQueue_[index]);
+        if (cell->GetVerifiedAt() != revision_ || !cell->HasCache()) {
+            RecalculateCell(*cell);
+            ++steps;
+        }
+    };
+    try {
+        for (size_t i = 0; i < priorityIndices.size() && !budgetExhausted(); ++i) {
+            process(priorityIndices[i]);
+        }
+        while (stepQueueNext_ < stepQueue_.size() && !budgetExhausted()) {
+            process(stepQueueNext_++);
+        }
+    } catch (...) {
+        recalculatedAt_ = previousRecalculation;
+        recalculating_ = false;
+        throw;
+    }
+
+    const bool finished = stepQueueNext_ == stepQueue_.size();
+    if (finished) {
+        FinishRecalculation();
+    } else {
+        recalculatedAt_ = previousRecalculation;
+    }
+    recalculating_ = false;
+    return finished;
+}
+
+std::vector<const Cell*> Sheet::CollectAffectedFormulas(
+        std::unordered_map<Position, size_t, PositionHasher>& indexByPos) const {
+    std::vector<const Cell*> result;
+    auto addAffected = [&](Position pos) {
+        const Cell* cell = cells_.Get(pos);
+        if (cell && cell->IsFormula() && indexByPos.emplace(pos, result.size()).second) {
+            result.push_back(cell);
+        }
+    };
+    for (const Position pos : changedCells_) {
+        addAffected(pos);
+        ForEachDependent(FindNode(pos), addAffected);
+    }
+    for (size_t i = 0; i < result.size(); ++i) {
+        ForEachDependent(result[i]->GetNodeId(), addAffected);
+    }
+    return result;
+}
+
+void Sheet::RecalculateCell(const Cell& cell) const {
+    // Формула могла быть уже проверена при чтении в этой ревизии. Если ни
+    // одна из ячеек, на которые она ссылается, не изменила значения,
+    // пересчёт не нужен.
+    if (!cell.HasCache()) {
+        cell.Evaluate();
+    } else if (cell.GetVerifiedAt() != revision_) {
+        if (HasChangedReferences(cell, cell.GetReferencedCells())) {
+            cell.Evaluate();
+        } else {
+            cell.MarkVerified();
+        }
+    }
+}
+
+void Sheet::FinishRecalculation() {
+    // Ёмкость списка изменённых позиций, которая сохраняется всегда
+    static const size_t MIN_CHANGED_CELLS_CAPACITY = 1024;
+
+    for (const Position pos : changedCells_) {
+        if (Cell* cell = cells_.Get(pos); cell) {
+            cell->SetQueued(false);
+        }
+    }
+    // Память списка, выросшего после удаления или изменения большого
+    // числа ячеек, освобождается
+    if (changedCells_.capacity() > std::max(MIN_CHANGED_CELLS_CAPACITY, cells_.Size())) {
+        std::vector<Position>().swap(changedCells_);
+    } else {
+        changedCells_.clear();
+    }
+    if (!erasedChangedCells_.empty()) {
+        // clear() сохранил бы корзины хеш-таблицы
+        std::unordered_set<Position, PositionHasher>().swap(erasedChangedCells_);
+    }
+    stepQueue_.clear();
+    stepQueueIndex_.clear();
+    stepQueueNext_ = 0;
+}
+
+bool Sheet::HasChangedReferences(const Cell& cell, const std::vector<Position>& references) const {
+    for (const Position pos : references) {
+        if (const Cell* referenced = cells_.Get(pos); referenced && referenced->GetChangedAt() > cell.GetVerifiedAt()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Sheet::ResetRevisions() {
+    Recalculate();
+    cells_.ForEach([](Position, Cell& cell) {
+        cell.ResetRevisions();
+    });
+    revision_ = 0;
+    recalculatedAt_ = 0;
+}
+
+void Sheet::EnableRecalcStats(bool enable) {
+    if (!enable) {
+        stats_.reset();
+    } else if (!stats_) {
+        stats_ = std::make_unique<RecalcStats>();
+    }
+}
+
+RecalcStats Sheet::GetRecalcStats() const {
+    return stats_ ? *stats_ : RecalcStats{};
+}
+
+void Sheet::ResetRecalcStats() {
+    if (stats_) {
+        *stats_ = RecalcStats{};
+    }
+}
+
+void Sheet::SetRecalcThreadCount(size_t threadCount) {
+    if (threadCount <= 1) {
+        workerPool_.reset();
+    } else if (!workerPool_ || workerPool_->GetThreadCount() != threadCount) {
+        workerPool_ = std::make_unique<WorkerPool>(threadCount);
+    }
+}
+
+Cell& Sheet::CreateCell(Position pos) {
+    if (minOrder_ == std::numeric_limits<int>::min() || maxOrder_ == std::numeric_limits<int>::max()) {
+        RenumberOrder();
+    }
+    Cell& cell = cells_.Emplace(pos, *this, pos);
+    rowOccupancy_.Add(pos.row);
+    colOccupancy_.Add(pos.col);
+    if (auto it = placeholders_.find(pos); it != placeholders_.end()) {
+        cell.SetNodeId(it->second);
+        cell.SetOrder(--minOrder_);
+        placeholders_.erase(it);
+    } else {
+        cell.SetOrder(++maxOrder_);
+    }
+    if (!erasedChangedCells_.empty() && erasedChangedCells_.erase(pos) != 0) {
+        cell.SetQueued(true);
+    }
+    return cell;
+}
+
+void Sheet::EraseCell(Position pos) {
+    Cell* cell = cells_.Get(pos);
+    const DependencyGraph::NodeId node = cell->GetNodeId();
+    if (node != DependencyGraph::NO_NODE && graph_.GetDependentCount(node) > 0) {
+        // У пустой позиции нет ревизии изменения, поэтому кэши формул,
+        // ссылающихся на неё, сбрасываются явно
+        ForEachDependent(node, [this](Position dependent) {
+            cells_.Get(dependent)->ResetCache();
+            if (stats_) {
+                stats_->cacheResets.Add();
+            }
+        });
+        placeholders_[pos] = node;
+        if (!cell->IsQueued()) {
+            AddChangedCell(pos);
+            cell->SetQueued(true);
+        }
+    } else if (node != DependencyGraph::NO_NODE) {
+        graph_.RemoveNode(node);
+    }
+    // Отметка о постановке в список хранится в ячейке и пропала бы вместе
+    // с ней
+    if (cell->IsQueued()) {
+        erasedChangedCells_.insert(pos);
+    }
+    cells_.Erase(pos);
+    rowOccupancy_.Remove(pos.row);
+    colOccupancy_.Remove(pos.col);
+}
+
+Size Sheet::GetPrintableSize() const {
+    return {rowOccupancy_.Extent(), colOccupancy_.Extent()};
+}
+
+std::vector<Position> Sheet::GetPrecedents(Position pos, bool transitive) const {
+    if (!pos.IsValid()) {
+        throw InvalidPositionException("Invalid cell position"s);
+    }
+    return GetPrecedents(Range{pos, pos}, transitive);
+}
+
+std::vector<Position> Sheet::GetDependents(Position pos, bool transitive) const {
+    if (!pos.IsValid()) {
+        throw InvalidPositionException("Invalid cell position"s);
+    }
+    const DependencyGraph::NodeId node = FindNode(pos);
+    if (node == DependencyGraph::NO_NODE) {
+        return {};
+    }
+    return CollectDependents({node}, transitive);
+}
+
+std::vector<Position> Sheet::GetPrecedents(Range range, bool transitive) const {
+    CheckRange(range);
+    // Каждая позиция, на которую ссылается формула, имеет вершину графа
+    DependencyGraph::NodeSet found(graph_.GetNodeLimit());
+    std::vector<const Cell*> formulas;
+    auto addReferences = [&](const Cell& cell) {
+        for (const Position reference : cell.GetReferencedCells()) {
+            if (!found.Insert(FindNode(reference)) || !transitive) {
+                continue;
+            }
+            if (const Cell* referenced = cells_.Get(reference); referenced && referenced->IsFormula()) {
+                formulas.push_back(referenced);
+            }
+        }
+    };
+    cells_.ForEachInRange(range.topLeft, range.bottomRight, [&](Position, const Cell& cell) {
+        if (cell.IsFormula()) {
+            addReferences(cell);
+        }
+    });
+    while (!formulas.empty()) {
+        const Cell* cell = formulas.back();
+        formulas.pop_back();
+        addReferences(*cell);
+    }
+    return ToPositions(found);
+}
+
+std::vector<Position> Sheet::GetDependents(Range range, bool transitive) const {
+    CheckRange(range);
+    std::vector<DependencyGraph::NodeId> roots;
+    const int64_t area = static_cast<int64_t>(range.bottomRight.row - range.topLeft.row + 1)
+            * (range.bottomRight.col - range.topLeft.col + 1);
+    if (area <= static_cast<int64_t>(placeholders_.size())) {
+        // Небольшая область: вершина каждой позиции ищется отдельно
+        for (int row = range.topLeft.row; row <= range.bottomRight.row; ++row) {
+            for (int col = range.topLeft.col; col <= range.bottomRight.col; ++col) {
+                const DependencyGraph::NodeId node = FindNode({row, col});
+                if (node != DependencyGraph::NO_NODE) {
+                    roots.push_back(node);
                 }
             }
         }
+    } else {
+        // Вершин пустых позиций меньше, чем позиций области
+        cells_.ForEachInRange(range.topLeft, range.bottomRight, [&](Position, const Cell& cell) {
+            if (cell.GetNodeId() != DependencyGraph::NO_NODE) {
+                roots.push_back(cell.GetNodeId());
+            }
+        });
+        for (const auto& [pos, node] : placeholders_) {
+            if (pos.row >= range.topLeft.row && pos.row <= range.bottomRight.row
+                    && pos.col >= range.topLeft.col && pos.col <= range.bottomRight.col) {
+                roots.push_back(node);
+            }
+        }
+    }
+    return CollectDependents(roots, transitive);
+}
+
+std::vector<Position> Sheet::CollectDependents(const std::vector<DependencyGraph::NodeId>& roots,
+        bool transitive) const {
+    DependencyGraph::NodeSet found(graph_.GetNodeLimit());
+    std::vector<DependencyGraph::NodeId> nodes;
+    auto addDependents = [&](DependencyGraph::NodeId node) {
+        graph_.ForEachDependent(node, [&](DependencyGraph::NodeId dependent) {
+            if (found.Insert(dependent) && transitive) {
+                nodes.push_back(dependent);
+            }
+        });
+    };
+    for (const DependencyGraph::NodeId root : roots) {
+        addDependents(root);
+    }
+    while (!nodes.empty()) {
+        const DependencyGraph::NodeId node = nodes.back();
+        nodes.pop_back();
+        addDependents(node);
+    }
+    return ToPositions(found);
+}
+
+std::vector<Position> Sheet::ToPositions(const DependencyGraph::NodeSet& nodes) const {
+    std::vector<Position> result;
+    nodes.ForEach([this, &result](DependencyGraph::NodeId node) {
+        result.push_back(graph_.GetPosition(node));
+    });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+MemoryStats Sheet::GetMemoryStats() const {
+    MemoryStats stats;
+    stats.storage = sizeof(*this) + cells_.GetMemoryUsage()
+            + rowOccupancy_.GetMemoryUsage() + colOccupancy_.GetMemoryUsage();
+    stats.strings = stringPool_.GetMemoryUsage();
+    stats.formulas = formulaPool_.GetMemoryUsage();
+    cells_.ForEach([&stats](Position, const Cell& cell) {
+        cell.AddMemoryUsage(stats);
+    });
+    // Узел хеш-таблицы хранит указатель на следующий узел, ключ и номер
+    const size_t placeholderNodeSize = sizeof(void*) + sizeof(Position) + sizeof(DependencyGraph::NodeId);
+    stats.dependencyGraph += graph_.GetMemoryUsage() + placeholders_.bucket_count() * sizeof(void*)
+            + placeholders_.size() * placeholderNodeSize;
+    // Список изменённых позиций с момента последнего пересчёта
+    const size_t changedNodeSize = sizeof(void*) + sizeof(Position);
+    stats.dependencyGraph += changedCells_.capacity() * sizeof(Position)
+            + erasedChangedCells_.bucket_count() * sizeof(void*)
+            + erasedChangedCells_.size() * changedNodeSize;
+    // Кэши хранятся внутри ячеек и уже учтены в размере блоков
+    stats.storage -= stats.caches;
+    return stats;
+}
+
+void Sheet::PrintValues(std::ostream& output) const {
+    PrintCells(output, [this](const Cell& cell, std::string& out) {
+        PrintCellValue(cell, out);
+    });
+}
+
+void Sheet::PrintTexts(std::ostream& output) const {
+    PrintCells(output, [](const Cell& cell, std::string& out) {
+        if (cell.IsFormula()) {
+            out += cell.GetText();
+        } else {
+            out += cell.GetTextView();
+        }
+    });
+}
+
+template <typename CellPrinter>
+void Sheet::PrintCells(std::ostream& output, CellPrinter printCell) const {
+    static const size_t FLUSH_THRESHOLD = 1 << 16;
+
+    const Size printableSize = GetPrintableSize();
+    if (printableSize.rows == 0) {
+        return;
+    }
+    const std::string tabs(printableSize.cols - 1, '\t');
+
+    std::string buffer;
+    buffer.reserve(FLUSH_THRESHOLD * 2);
+    auto flushIfFull = [&output, &buffer]() {
+        if (buffer.size() >= FLUSH_THRESHOLD) {
+            output.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    };
+
+    // Позиция курсора: текущая строка и число табуляций, уже выведенных в ней
+    int row = 0;
+    int tabsInRow = 0;
+    auto finishRow = [&]() {
+        buffer.append(tabs, 0, tabs.size() - tabsInRow);
+        buffer += '\n';
+        tabsInRow = 0;
+        ++row;
+        flushIfFull();
+    };
+
+    cells_.ForEach([&](Position pos, const Cell& cell) {
+        while (row < pos.row) {
+            finishRow();
+        }
+        buffer.append(tabs, 0, pos.col - tabsInRow);
+        tabsInRow = pos.col;
+        printCell(cell, buffer);
+    });
+    while (row < printableSize.rows) {
+        finishRow();
     }
-    Resize(newPrintableSize);
+    output.write(buffer.data(), buffer.size());
 }
 
-void Sheet::PrintCellValue(const CellInterface *cell, std::ostream &out) const {
-    CellInterface::Value value = cell->GetValue();
+void Sheet::PrintCellValue(const Cell& cell, std::string& out) const {
+    Cell::ValueView value = cell.GetValueView();
     if (std::holds_alternative<double>(value)) {
-        out << std::get<double>(value);
-    } else if (std::holds_alternative<std::string>(value)) {
-        out << std::get<std::string>(value);
+        // %g совпадает с форматом вывода double в поток по умолчанию
+        char number[32];
+        const int length = std::snprintf(number, sizeof(number), "%g", std::get<double>(value));
+        out.append(number, length);
+    } else if (std::holds_alternative<std::string_view>(value)) {
+        out += std::get<std::string_view>(value);
     } else if (std::holds_alternative<FormulaError>(value)) {
-        out << std::get<FormulaError>(value);
+        out += std::get<FormulaError>(value).ToString();
     } else {
         throw std::runtime_error("Print cell value: something wrong"s);
     }
@@ -1,10 +1,24 @@
 #pragma once
 
+#include "dependency_graph.h"
 #include "errors.h"
+#include "formula_pool.h"
+#include "occupancy_counter.h"
 #include "position.h"
+#include "recalc_stats.h"
+#include "string_pool.h"
+#include "tile_storage.h"
+#include "worker_pool.h"
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 struct Size {
     int rows = 0;
@@ -15,9 +29,43 @@ struct Size {
     }
 };
 
+// Прямоугольная область таблицы; обе границы входят в область
+struct Range {
+    Position topLeft;
+    Position bottomRight;
+};
+
+// Ограничение объёма работы одного шага пересчёта; нулевое поле не
+// ограничивает
+struct RecalcBudget {
+    // Наибольшее число обработанных формул
+    size_t maxFormulas = 0;
+    // Наибольшая длительность шага
+    std::chrono::nanoseconds maxDuration{0};
+};
+
 class CellInterface;
 class Cell;
 
+// Оценка памяти, занимаемой таблицей, в байтах по категориям
+struct MemoryStats {
+    // Блоки с ячейками, их каталог и счётчики печатной области
+    size_t storage = 0;
+    // Списки зависимостей вверх и вниз и список позиций, изменённых после
+    // последнего пересчёта
+    size_t dependencyGraph = 0;
+    // Объекты формул с их синтаксическими деревьями
+    size_t formulas = 0;
+    // Место под кэшированные значения формул
+    size_t caches = 0;
+    // Пул длинных текстов
+    size_t strings = 0;
+
+    size_t Total() const {
+        return storage + dependencyGraph + formulas + caches + strings;
+    }
+};
+
 // Интерфейс таблицы
 class SheetInterface {
 public:
@@ -70,8 +118,20 @@ public:
 
     void SetCell(Position pos, std::string text) override;
 
+    // Задаёт содержимое сразу нескольких ячеек. Все формулы разбираются
+    // заранее, циклические зависимости ищутся одним обходом общего графа,
+    // а весь пакет составляет одну ревизию таблицы. Если позиция
+    // встречается несколько раз, действует последнее значение.
+    // При синтаксической ошибке бросается FormulaException, при циклической
+    // зависимости - CircularDependencyException со списком всех ячеек,
+    // входящих в циклы; в обоих случаях таблица не изменяется.
+    void SetCells(const std::vector<std::pair<Position, std::string>>& cells);
+
     const CellInterface* GetCell(Position pos) const override;
     CellInterface* GetCell(Position pos) override;
+    // Ячейка в допустимой позиции pos или nullptr, без проверки позиции и
+    // виртуального вызова. Определена в cell.h, где тип Cell полон.
+    inline const Cell* FindCell(Position pos) const;
 
     void ClearCell(Position pos) override;
 
@@ -80,11 +140,204 @@ public:
     void PrintValues(std::ostream& output) const override;
     void PrintTexts(std::ostream& output) const override;
 
-    void Resize(Size newSize);
+    // Пересчитывает формулы, зависящие от ячеек, изменённых после
+    // последнего пересчёта. Формулы упорядочиваются топологически по графу
+    // зависимостей, поэтому каждая вычисляется не более одного раза, когда
+    // значения всех ячеек, от которых она зависит, уже известны. Формула,
+    // у которой ни одна из ячеек, на которые она ссылается, не изменила
+    // значения, не вычисляется, поэтому изменение останавливается на
+    // формулах с прежним результатом. После пересчёта все кэши актуальны, и
+    // чтение значений не требует проверок.
+    void Recalculate();
+
+    // Выполняет часть пересчёта в пределах бюджета и возвращает true, если
+    // пересчёт завершён. Сначала обрабатываются затронутые изменениями
+    // формулы области priority вместе с затронутыми формулами, от которых
+    // они зависят, затем остальные в топологическом порядке; следующий
+    // вызов продолжает с места остановки. Каждый вызов обрабатывает хотя бы
+    // одну формулу, поэтому повторные вызовы завершают пересчёт. Таблицу
+    // можно изменять между вызовами: очередь строится заново, а уже
+    // вычисленные формулы, не затронутые изменением, только подтверждаются.
+    // Ячейки вне области между вызовами читаются как обычно, с проверкой.
+    bool RecalculateStep(Range priority, RecalcBudget budget);
+
+    // Задаёт число потоков пересчёта. Формулы одного топологического уровня
+    // не зависят друг от друга и вычисляются параллельно; результат
+    // совпадает с последовательным пересчётом. По умолчанию используется
+    // один поток.
+    void SetRecalcThreadCount(size_t threadCount);
+
+    // Позиции, на которые ссылается формула в pos (включая пустые), и
+    // ячейки, формулы которых ссылаются на pos. При transitive = true в
+    // результат входят и косвенные зависимости. Позиции возвращаются по
+    // возрастанию, без повторов. Для недопустимой позиции бросается
+    // InvalidPositionException.
+    std::vector<Position> GetPrecedents(Position pos, bool transitive) const;
+    std::vector<Position> GetDependents(Position pos, bool transitive) const;
+    // То же для всех позиций области: объединение результатов, в которое
+    // входят и позиции самой области, связанные с другими её позициями
+    std::vector<Position> GetPrecedents(Range range, bool transitive) const;
+    std::vector<Position> GetDependents(Range range, bool transitive) const;
+
+    // Включает и выключает сбор статистики пересчёта: счётчиков обращений к
+    // кэшам и вычислений, гистограмм длительности разбора, проверки циклов,
+    // регистрации изменений и вычисления формул. По умолчанию сбор
+    // выключен и стоит одной проверки указателя на операцию. Включение
+    // начинает статистику с нуля, выключение её удаляет.
+    void EnableRecalcStats(bool enable);
+    // Копия накопленной статистики; нулевая, если сбор выключен
+    RecalcStats GetRecalcStats() const;
+    void ResetRecalcStats();
+    // Статистика для обновления; nullptr, если сбор выключен
+    RecalcStats* GetActiveRecalcStats() const {
+        return stats_.get();
+    }
+
+    // Оценивает память, занимаемую таблицей, за один проход по ячейкам
+    MemoryStats GetMemoryStats() const;
+
+    // Пул, в котором хранятся длинные тексты ячеек
+    StringPool& GetStringPool() {
+        return stringPool_;
+    }
+
+    // Пул, в котором хранятся разобранные формулы ячеек
+    FormulaPool& GetFormulaPool() {
+        return formulaPool_;
+    }
 
 private:
-    void Squeeze();
-    void PrintCellValue(const CellInterface* cell, std::ostream& out) const;
-    std::unordered_map<Position, std::unique_ptr<Cell>, PositionHasher> cells_;
-    Size printableSize_;
+    // Ячейки регистрируют свои ссылки и изменения через закрытые методы
+    // таблицы ниже
+    friend class Cell;
+
+    // Регистрирует ячейку dependent как зависящую от позиции pos и отменяет
+    // такую регистрацию. Если в pos нет ячейки, зависимость хранится в
+    // вершине графа для пустой позиции без создания ячейки; когда в pos
+    // появится ячейка, она получит эту вершину со всеми зависимостями.
+    void AddDependent(Position pos, Position dependent);
+    void RemoveDependent(Position pos, Position dependent);
+
+    // Перестраивает топологический порядок ячеек так, чтобы ячейки
+    // references шли раньше pos (алгоритм Пирса-Келли). Переставляются
+    // только ячейки, номера которых лежат между номерами концов нарушающей
+    // порядок ссылки. Возвращает false, если ссылка замкнула бы цикл;
+    // порядок при этом остаётся корректным.
+    bool UpdateOrder(Position pos, const std::vector<Position>& references);
+
+    // Ревизии таблицы. Каждое изменение содержимого (ячейки или пакета
+    // ячеек) начинает новую ревизию; ячейки помнят, в какой ревизии
+    // изменилось их значение и в какой был проверен кэш формулы.
+    uint32_t NewRevision();
+    uint32_t GetRevision() const {
+        return revision_;
+    }
+    // Актуален ли кэш, проверенный в ревизии verifiedAt. После полного
+    // пересчёта актуальны все кэши, независимо от ревизии проверки.
+    bool IsVerified(uint32_t verifiedAt) const {
+        return verifiedAt == revision_ || recalculatedAt_ == revision_;
+    }
+
+    // Добавляет позицию в список изменённых после последнего пересчёта
+    void AddChangedCell(Position pos);
+
+    // Делает актуальным значение формулы при чтении. Обходятся только
+    // ячейки, от которых формула транзитивно зависит и кэш которых не
+    // проверен в текущей ревизии; формула вычисляется заново, только если
+    // изменилась одна из ячеек, на которые она ссылается. Стек обхода
+    // хранится в куче.
+    void BringUpToDate(const Cell& cell);
+
+    // Объявлены до cells_, чтобы пережить ячейки при уничтожении таблицы
+    StringPool stringPool_;
+    FormulaPool formulaPool_;
+
+    // Создаёт ячейку в свободной позиции, забирая вершину графа пустой
+    // позиции, если на неё ссылаются
+    Cell& CreateCell(Position pos);
+    // Удаляет ячейку, оставляя её вершину графа пустой позиции, если на
+    // неё ссылаются
+    void EraseCell(Position pos);
+
+    // Вершина графа для позиции: ячейки или пустой позиции, на которую
+    // ссылаются. FindNode возвращает NO_NODE, если вершины нет.
+    DependencyGraph::NodeId FindNode(Position pos) const;
+    DependencyGraph::NodeId GetOrCreateNode(Position pos);
+    // Вызывает visitor(Position) для каждой ячейки, зависящей от вершины
+    template <typename Visitor>
+    void ForEachDependent(DependencyGraph::NodeId node, Visitor&& visitor) const;
+    // Ячейки, зависящие от вершин roots (при transitive = true и
+    // косвенно), по возрастанию позиций
+    std::vector<Position> CollectDependents(const std::vector<DependencyGraph::NodeId>& roots,
+            bool transitive) const;
+    // Позиции вершин множества по возрастанию
+    std::vector<Position> ToPositions(const DependencyGraph::NodeSet& nodes) const;
+
+    // Восстанавливает порядок для ссылки from -> to, где from имеет больший
+    // номер. Возвращает false, если to уже влияет на from.
+    bool Reorder(Cell& from, Cell& to);
+    // Даёт ячейкам roots и всем ячейкам, транзитивно зависящим от них,
+    // номера после всех остальных в топологическом порядке графа
+    // зависимостей. Граф не должен содержать циклов.
+    void OrderLast(const std::vector<Cell*>& roots);
+    // Перенумеровывает ячейки подряд с сохранением порядка, когда номера
+    // подходят к границам диапазона int
+    void RenumberOrder();
+    // Формулы, транзитивно зависящие от позиций changedCells_; indexByPos
+    // получает индексы формул в результате
+    std::vector<const Cell*> CollectAffectedFormulas(
+            std::unordered_map<Position, size_t, PositionHasher>& indexByPos) const;
+    // Делает актуальной формулу, все ячейки которой, на которые она
+    // ссылается, уже актуальны
+    void RecalculateCell(const Cell& cell) const;
+    // Завершает пересчёт: очищает список изменений и очередь пошагового
+    // пересчёта
+    void FinishRecalculation();
+    // Изменилась ли после последней проверки кэша формулы cell одна из
+    // ячеек references, на которые она ссылается
+    bool HasChangedReferences(const Cell& cell, const std::vector<Position>& references) const;
+    // Обнуляет ревизии таблицы и ячеек при переполнении счётчика ревизий,
+    // предварительно сделав актуальными все кэши
+    void ResetRevisions();
+
+    // Выводит печатную область, обходя только занятые ячейки. Пропуски между
+    // ними заполняются табуляциями целыми блоками, вывод идёт через буфер.
+    template <typename CellPrinter>
+    void PrintCells(std::ostream& output, CellPrinter printCell) const;
+    void PrintCellValue(const Cell& cell, std::string& out) const;
+    TileStorage<Cell> cells_;
+    // Количество ячеек в каждой строке и в каждом столбце; по ним
+    // определяется печатная область без обхода таблицы
+    OccupancyCounter<Position::MAX_ROWS> rowOccupancy_;
+    OccupancyCounter<Position::MAX_COLS> colOccupancy_;
+    // Зависимости между позициями таблицы
+    DependencyGraph graph_;
+    // Вершины графа для пустых позиций, на которые ссылаются формулы
+    std::unordered_map<Position, DependencyGraph::NodeId, PositionHasher> placeholders_;
+    // Позиции, изменённые после последнего пересчёта, включая удалённые
+    // ячейки; каждая позиция встречается не более одного раза
+    std::vector<Position> changedCells_;
+    // Позиции из changedCells_, ячейки которых удалены. Ячейка, созданная
+    // в такой позиции, уже стоит в списке и второй раз не добавляется.
+    std::unordered_set<Position, PositionHasher> erasedChangedCells_;
+    uint32_t revision_ = 0;
+    // Ревизия, в которой выполнен последний полный пересчёт
+    uint32_t recalculatedAt_ = 0;
+    bool recalculating_ = false;
+    // Очередь пошагового пересчёта: затронутые формулы в топологическом
+    // порядке, их индексы в очереди, число уже обработанных и ревизия, в
+    // которой очередь построена
+    std::vector<Position> stepQueue_;
+    std::unordered_map<Position, size_t, PositionHasher> stepQueueIndex_;
+    size_t stepQueueNext_ = 0;
+    uint32_t stepQueueRevision_ = 0;
+    // Наименьший и наибольший выданные номера топологического порядка.
+    // Ячейка, на которую уже ссылаются, получает номер меньше всех, иначе -
+    // больше всех, поэтому дописывание цепочки не требует перестановок.
+    int minOrder_ = 0;
+    int maxOrder_ = 0;
+    // nullptr при последовательном пересчёте
+    std::unique_ptr<WorkerPool> workerPool_;
+    // nullptr, пока сбор статистики выключен
+    std::unique_ptr<RecalcStats> stats_;
 };
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "intern_table.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Пул строк с подсчётом ссылок. Одинаковые строки хранятся в единственном
+// экземпляре и удаляются, когда на них не остаётся ссылок.
+class StringPool {
+public:
+    // Ключ записи - сама строка, значение - пул, которому запись
+    // принадлежит
+    using Entry = InternTable<StringPool*>::Entry;
+
+    StringPool() = default;
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    Entry* Acquire(std::string_view text) {
+        return entries_.Acquire(text, [this] {
+            return this;
+        });
+    }
+
+    void Release(Entry* entry) {
+        entries_.Release(entry);
+    }
+
+    // Количество различных строк в пуле
+    size_t Size() const {
+        return entries_.Size();
+    }
+
+    // Оценка памяти, занимаемой пулом
+    size_t GetMemoryUsage() const {
+        return entries_.GetMemoryUsage([](StringPool*) {
+            return size_t{0};
+        });
+    }
+
+private:
+    InternTable<StringPool*> entries_;
+};
+
+// Неизменяемая строка: короткие строки хранятся внутри объекта, длинные -
+// в пуле StringPool. Чтение не требует копирования. Объект занимает 24 байта:
+// символы (или указатель на запись пула) и в последнем байте - длина либо
+// признак хранения в пуле.
+class PooledString {
+public:
+    static const size_t INLINE_CAPACITY = 22;
+
+    PooledString() noexcept {
+        SetInline({});
+    }
+
+    PooledString(StringPool& pool, std::string_view text) {
+        if (text.size() <= INLINE_CAPACITY) {
+            SetInline(text);
+        } else {
+            SetEntry(pool.Acquire(text));
+        }
+    }
+
+    PooledString(const PooledString& other) noexcept {
+        CopyFrom(other);
+    }
+
+    PooledString(PooledString&& other) noexcept {
+        std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+        other.SetInline({});
+    }
+
+    PooledString& operator=(const PooledString& other) noexcept {
+        if (this != &other) {
+            Release();
+            CopyFrom(other);
+        }
+        return *this;
+    }
+
+    PooledString& operator=(PooledString&& other) noexcept {
+        if (this != &other) {
+            Release();
+            std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+            other.SetInline({});
+        }
+        return *this;
+    }
+
+    ~PooledString() {
+        Release();
+    }
+
+    std::string_view View() const {
+        if (IsShared()) {
+            return GetEntry()->key;
+        }
+        return {bytes_, static_cast<uint8_t>(bytes_[TAG_INDEX])};
+    }
+
+    // Хранится ли строка в пуле
+    bool IsShared() const {
+        return static_cast<uint8_t>(bytes_[TAG_INDEX]) == SHARED;
+    }
+
+private:
+    static const size_t TAG_INDEX = INLINE_CAPACITY + 1;
+    static const uint8_t SHARED = 0xFF;
+    static_assert(INLINE_CAPACITY < SHARED, "inline size must fit the tag");
+
+    void SetInline(std::string_view text) noexcept {
+        if (!text.empty()) {
+            std::memcpy(bytes_, text.data(), text.size());
+        }
+        bytes_[text.size()] = '\0';
+        bytes_[TAG_INDEX] = static_cast<char>(text.size());
+    }
+
+    StringPool::Entry* GetEntry() const noexcept {
+        StringPool::Entry* entry;
+        std::memcpy(&entry, bytes_, sizeof(entry));
+        return entry;
+    }
+
+    void SetEntry(StringPool::Entry* entry) noexcept {
+        std::memcpy(bytes_, &entry, sizeof(entry));
+        bytes_[TAG_INDEX] = static_cast<char>(SHARED);
+    }
+
+    void CopyFrom(const PooledString& other) noexcept {
+        std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+        if (IsShared()) {
+            ++GetEntry()->refCount;
+        }
+    }
+
+    void Release() noexcept {
+        if (IsShared()) {
+            StringPool::Entry* entry = GetEntry();
+            entry->value->Release(entry);
+            SetInline({});
+        }
+    }
+
+    alignas(StringPool::Entry*) char bytes_[TAG_INDEX + 1];
+};
+
+static_assert(sizeof(PooledString) == 24, "pooled string must stay compact");
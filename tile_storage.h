@@ -0,0 +1,251 @@
+#pragma once
+
+#include "bit_utils.h"
+#include "position.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Разреженное хранилище объектов, привязанных к позициям таблицы.
+// Таблица разбивается на квадратные блоки TILE_SIZE x TILE_SIZE, которые
+// выделяются при первом обращении. Объекты хранятся внутри блока без
+// дополнительных аллокаций, поэтому соседние ячейки лежат в памяти рядом,
+// а адрес объекта не меняется до его удаления.
+template <typename T>
+class TileStorage {
+public:
+    static const int TILE_SIZE = 64;
+
+    TileStorage() = default;
+    TileStorage(const TileStorage&) = delete;
+    TileStorage& operator=(const TileStorage&) = delete;
+
+    ~TileStorage() {
+        Clear();
+    }
+
+    T* Get(Position pos) {
+        return const_cast<T*>(std::as_const(*this).Get(pos));
+    }
+
+    const T* Get(Position pos) const {
+        const Tile* tile = FindTile(pos);
+        if (!tile || !tile->IsOccupied(pos.row % TILE_SIZE, pos.col % TILE_SIZE)) {
+            return nullptr;
+        }
+        return tile->At(pos.row % TILE_SIZE, pos.col % TILE_SIZE);
+    }
+
+    // Создаёт объект в свободной позиции
+    template <typename... Args>
+    T& Emplace(Position pos, Args&&... args) {
+        Tile& tile = GetOrCreateTile(pos);
+        const int row = pos.row % TILE_SIZE;
+        const int col = pos.col % TILE_SIZE;
+        T* object = new (tile.At(row, col)) T(std::forward<Args>(args)...);
+        tile.SetOccupied(row, col);
+        ++size_;
+        return *object;
+    }
+
+    // Удаляет объект. Опустевший блок откладывается для повторного
+    // использования, если запас свободных блоков не исчерпан, иначе
+    // освобождается
+    void Erase(Position pos) {
+        Tile* tile = FindTile(pos);
+        const int row = pos.row % TILE_SIZE;
+        const int col = pos.col % TILE_SIZE;
+        if (!tile || !tile->IsOccupied(row, col)) {
+            return;
+        }
+        tile->At(row, col)->~T();
+        tile->ResetOccupied(row, col);
+        --size_;
+        if (tile->count == 0) {
+            auto& slot = tiles_[pos.row / TILE_SIZE][pos.col / TILE_SIZE];
+            if (spareTiles_.size() < MAX_SPARE_TILES) {
+                spareTiles_.push_back(std::move(slot));
+            } else {
+                slot.reset();
+            }
+        }
+    }
+
+    void Clear() {
+        for (auto& tileRow : tiles_) {
+            for (auto& tile : tileRow) {
+                if (tile) {
+                    tile->DestroyAll();
+                    tile.reset();
+                }
+            }
+        }
+        tiles_.clear();
+        size_ = 0;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    // Память, занимаемая блоками (включая запасные) и их каталогом
+    size_t GetMemoryUsage() const {
+        size_t tileCount = spareTiles_.size();
+        size_t result = tiles_.capacity() * sizeof(tiles_[0])
+                + spareTiles_.capacity() * sizeof(spareTiles_[0]);
+        for (const auto& row : tiles_) {
+            result += row.capacity() * sizeof(row[0]);
+            for (const auto& tile : row) {
+                tileCount += tile ? 1 : 0;
+            }
+        }
+        return result + tileCount * sizeof(Tile);
+    }
+
+    // Обходит занятые позиции построчно (по возрастанию Position) и вызывает
+    // visitor(Position, const T&). Пустые блоки и строки блоков пропускаются
+    // целиком, внутри строки блока занятые столбцы берутся из маски.
+    template <typename Visitor>
+    void ForEach(Visitor&& visitor) const {
+        ForEachIn(*this, FIRST, LAST, visitor);
+    }
+
+    // То же с доступом на изменение: visitor(Position, T&)
+    template <typename Visitor>
+    void ForEach(Visitor&& visitor) {
+        ForEachIn(*this, FIRST, LAST, visitor);
+    }
+
+    // Обходит занятые позиции прямоугольника [topLeft, bottomRight] в том
+    // же порядке; блоки вне прямоугольника не просматриваются
+    template <typename Visitor>
+    void ForEachInRange(Position topLeft, Position bottomRight, Visitor&& visitor) const {
+        ForEachIn(*this, topLeft, bottomRight, visitor);
+    }
+
+private:
+    struct Tile {
+        alignas(T) unsigned char storage[TILE_SIZE * TILE_SIZE * sizeof(T)];
+        // Маска занятых позиций: один бит на столбец для каждой строки блока
+        uint64_t rowMasks[TILE_SIZE] = {};
+        int count = 0;
+
+        T* At(int row, int col) {
+            return reinterpret_cast<T*>(storage) + row * TILE_SIZE + col;
+        }
+        const T* At(int row, int col) const {
+            return reinterpret_cast<const T*>(storage) + row * TILE_SIZE + col;
+        }
+
+        bool IsOccupied(int row, int col) const {
+            return (rowMasks[row] >> col) & 1u;
+        }
+        void SetOccupied(int row, int col) {
+            rowMasks[row] |= uint64_t{1} << col;
+            ++count;
+        }
+        void ResetOccupied(int row, int col) {
+            rowMasks[row] &= ~(uint64_t{1} << col);
+            --count;
+        }
+
+        void DestroyAll() {
+            for (int row = 0; row < TILE_SIZE; ++row) {
+                for (int col = 0; col < TILE_SIZE; ++col) {
+                    if (IsOccupied(row, col)) {
+                        At(row, col)->~T();
+                    }
+                }
+                rowMasks[row] = 0;
+            }
+            count = 0;
+        }
+    };
+
+    static_assert(TILE_SIZE == 64, "row masks are 64-bit wide");
+
+    static const size_t MAX_SPARE_TILES = 2;
+    static constexpr Position FIRST{0, 0};
+    static constexpr Position LAST{Position::MAX_ROWS - 1, Position::MAX_COLS - 1};
+
+    const Tile* FindTile(Position pos) const {
+        const size_t tileRow = pos.row / TILE_SIZE;
+        const size_t tileCol = pos.col / TILE_SIZE;
+        if (tileRow >= tiles_.size() || tileCol >= tiles_[tileRow].size()) {
+            return nullptr;
+        }
+        return tiles_[tileRow][tileCol].get();
+    }
+
+    Tile* FindTile(Position pos) {
+        return const_cast<Tile*>(std::as_const(*this).FindTile(pos));
+    }
+
+    // Маска столбцов блока tileCol, попадающих в [firstCol, lastCol]
+    static uint64_t ColumnMask(size_t tileCol, int firstCol, int lastCol) {
+        const int tileStart = static_cast<int>(tileCol) * TILE_SIZE;
+        const int first = std::max(firstCol - tileStart, 0);
+        const int last = std::min(lastCol - tileStart, TILE_SIZE - 1);
+        return (~uint64_t{0} << first) & (~uint64_t{0} >> (TILE_SIZE - 1 - last));
+    }
+
+    template <typename Storage, typename Visitor>
+    static void ForEachIn(Storage& storage, Position topLeft, Position bottomRight, Visitor& visitor) {
+        const size_t tileRowEnd = std::min<size_t>(bottomRight.row / TILE_SIZE + 1, storage.tiles_.size());
+        for (size_t tileRow = topLeft.row / TILE_SIZE; tileRow < tileRowEnd; ++tileRow) {
+            auto& row = storage.tiles_[tileRow];
+            const size_t tileColEnd = std::min<size_t>(bottomRight.col / TILE_SIZE + 1, row.size());
+            const int tileStart = static_cast<int>(tileRow) * TILE_SIZE;
+            const int firstRowInTile = std::max(topLeft.row - tileStart, 0);
+            const int lastRowInTile = std::min(bottomRight.row - tileStart, TILE_SIZE - 1);
+            for (int rowInTile = firstRowInTile; rowInTile <= lastRowInTile; ++rowInTile) {
+                for (size_t tileCol = topLeft.col / TILE_SIZE; tileCol < tileColEnd; ++tileCol) {
+                    auto* tile = row[tileCol].get();
+                    if (!tile) {
+                        continue;
+                    }
+                    const uint64_t mask = ColumnMask(tileCol, topLeft.col, bottomRight.col);
+                    for (uint64_t bits = tile->rowMasks[rowInTile] & mask; bits != 0; bits &= bits - 1) {
+                        const int colInTile = LowestBit(bits);
+                        visitor(Position{static_cast<int>(tileRow) * TILE_SIZE + rowInTile,
+                                         static_cast<int>(tileCol) * TILE_SIZE + colInTile},
+                                *tile->At(rowInTile, colInTile));
+                    }
+                }
+            }
+        }
+    }
+
+    Tile& GetOrCreateTile(Position pos) {
+        const size_t tileRow = pos.row / TILE_SIZE;
+        const size_t tileCol = pos.col / TILE_SIZE;
+        if (tileRow >= tiles_.size()) {
+            tiles_.resize(tileRow + 1);
+        }
+        auto& row = tiles_[tileRow];
+        if (tileCol >= row.size()) {
+            row.resize(tileCol + 1);
+        }
+        if (!row[tileCol]) {
+            if (!spareTiles_.empty()) {
+                row[tileCol] = std::move(spareTiles_.back());
+                spareTiles_.pop_back();
+            } else {
+                // без value-инициализации, чтобы не обнулять хранилище объектов
+                row[tileCol].reset(new Tile);
+            }
+        }
+        return *row[tileCol];
+    }
+
+    // tiles_[i][j] - блок, покрывающий строки [i*TILE_SIZE, (i+1)*TILE_SIZE)
+    // и столбцы [j*TILE_SIZE, (j+1)*TILE_SIZE)
+    std::vector<std::vector<std::unique_ptr<Tile>>> tiles_;
+    // Опустевшие блоки, готовые к повторному использованию
+    std::vector<std::unique_ptr<Tile>> spareTiles_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,102 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t threadCount) {
+    for (size_t i = 1; i < threadCount; ++i) {
+        workers_.emplace_back([this]() {
+            WorkerLoop();
+        });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    taskStarted_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+void WorkerPool::ParallelFor(size_t count, size_t chunkSize, const Task& task) {
+    chunkSize = std::max<size_t>(chunkSize, 1);
+    if (workers_.empty() || count <= chunkSize) {
+        // Будить рабочих ради одной части дороже, чем выполнить её сразу
+        for (size_t begin = 0; begin < count; begin += chunkSize) {
+            task(begin, std::min(begin + chunkSize, count));
+        }
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        task_ = &task;
+        count_ = count;
+        chunkSize_ = chunkSize;
+        nextChunk_ = 0;
+        error_ = nullptr;
+        activeWorkers_ = workers_.size();
+        ++generation_;
+    }
+    taskStarted_.notify_all();
+    RunChunks();
+
+    std::exception_ptr error;
+    {
+        std::unique_lock lock(mutex_);
+        taskFinished_.wait(lock, [this]() {
+            return activeWorkers_ == 0;
+        });
+        task_ = nullptr;
+        error = std::move(error_);
+        error_ = nullptr;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void WorkerPool::WorkerLoop() {
+    uint64_t lastGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock lock(mutex_);
+            taskStarted_.wait(lock, [&]() {
+                return stopping_ || generation_ != lastGeneration;
+            });
+            if (stopping_) {
+                return;
+            }
+            lastGeneration = generation_;
+        }
+        RunChunks();
+        {
+            std::lock_guard lock(mutex_);
+            if (--activeWorkers_ == 0) {
+                taskFinished_.notify_one();
+            }
+        }
+    }
+}
+
+void WorkerPool::RunChunks() {
+    while (true) {
+        const size_t begin = nextChunk_.fetch_add(chunkSize_);
+        if (begin >= count_) {
+            return;
+        }
+        try {
+            (*task_)(begin, std::min(begin + chunkSize_, count_));
+        } catch (...) {
+            std::lock_guard lock(mutex_);
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+            // Остальные части уже не нужны
+            nextChunk_ = count_;
+        }
+    }
+}
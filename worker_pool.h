@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул рабочих потоков для параллельной обработки диапазона индексов.
+// Вызывающий поток участвует в работе наравне с рабочими, поэтому пул из
+// threadCount потоков создаёт threadCount - 1 рабочий поток.
+class WorkerPool {
+public:
+    using Task = std::function<void(size_t begin, size_t end)>;
+
+    explicit WorkerPool(size_t threadCount);
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool();
+
+    size_t GetThreadCount() const {
+        return workers_.size() + 1;
+    }
+
+    // Разбивает [0, count) на части не длиннее chunkSize, вызывает для них
+    // task(begin, end) во всех потоках пула и ждёт завершения. Если task
+    // бросает исключение, оставшиеся части не обрабатываются, а первое
+    // исключение перебрасывается в вызывающий поток.
+    void ParallelFor(size_t count, size_t chunkSize, const Task& task);
+
+private:
+    void WorkerLoop();
+    // Забирает и обрабатывает части текущей задачи, пока они не кончатся
+    void RunChunks();
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable taskStarted_;
+    std::condition_variable taskFinished_;
+
+    // Текущая задача; поля меняются только при отсутствии активных рабочих
+    const Task* task_ = nullptr;
+    size_t count_ = 0;
+    size_t chunkSize_ = 1;
+    std::atomic<size_t> nextChunk_{0};
+    std::exception_ptr error_;
+
+    // Номер текущей задачи, по которому рабочие узнают о новой задаче
+    uint64_t generation_ = 0;
+    size_t activeWorkers_ = 0;
+    bool stopping_ = false;
+};